@@ -0,0 +1,867 @@
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <stdbool.h>
+#include <stdio.h>
+#include <SDL2/SDL.h>
+#include "dsp.h"
+#include "midi.h"
+#include "osc.h"
+#include "reverb.h"
+#include "synth.h"
+#include "tables.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define UNIT "cycles"
+static Uint64 ticks() {
+    return __rdtsc();
+}
+#else
+#define UNIT "ticks"
+static Uint64 ticks() {
+    return SDL_GetPerformanceCounter();
+}
+#endif
+
+/* Micro-benchmark for the oscillators: renders one voice of every wave form
+ * with the phase accumulator, and with the fmod/sin code addFrequencies used
+ * before it, reporting the cost per sample and how far apart the two are.
+ * Then times every kernel in dsp.h for each instruction set this CPU has,
+ * and checks that their output is identical to the scalar one, and what a
+ * loop that tests the wave form per sample costs against them. Last, it
+ * measures how much aliasing a high note has with the naive, band-limited
+ * and oversampled oscillators, and what each costs, and what the whole
+ * engine costs per sample for every wave form with more and more keys down,
+ * and what the fixed point FM of the OPL2 wave forms costs at full
+ * polyphony next to the float oscillators, and the convolution reverb per
+ * buffer for impulse responses of half a second to five.
+ * On Linux it finally times MIDI input, from writing a note into a FIFO
+ * until the audio thread can see it.
+ */
+
+#define RATE 44100
+#define BUFFER 1024
+#define BUFFERS 2000
+#define MIDI_NOTES 1000
+#define MIDI_FIFO "piano-bench.fifo" // made and removed again
+
+static const double freqs[] = { 110, 440, 1760 };
+
+/* The old per-sample code from addFrequencies, values without the volume
+ */
+static double legacy(WaveForm wave, double part, double tone) {
+    double sine_tone = tone / (2 * M_PI);
+    double qtone = tone * 0.35;
+    double htone = tone * 0.5;
+    double ttone = tone * 0.75;
+
+    switch (wave) {
+        case square:
+            return part < htone ? -1 : 1;
+        case triangle:
+            if (part <= qtone) {
+                return part / qtone;
+            } else if (part <= htone) {
+                return 1 - (part - qtone) / qtone;
+            } else if (part <= ttone) {
+                return 0 - (part - htone) / qtone;
+            }
+            return -1 + (part - ttone) / qtone;
+        case saw:
+            return -1.0 + part / tone * 2;
+        case noise:
+            return (random() % 20) - 10;
+        case sine:
+            return sin(part / sine_tone);
+        case opl2_1:
+            return part <= htone ? sin(part / sine_tone) : 0;
+        case opl2_2:
+            return part <= htone ? sin(part / sine_tone) :
+                -sin(part / sine_tone);
+        case opl2_3:
+            if (part <= qtone) {
+                return sin(part / sine_tone);
+            } else if (part <= htone) {
+                return 0;
+            } else if (part <= ttone) {
+                return -sin(part / sine_tone);
+            }
+            return 0;
+    }
+    return 0;
+}
+
+/* One buffer the way addFrequencies used to do it
+ */
+static void legacyBuffer(WaveForm wave, Sint32 *audio, double *wave_part,
+        double tone, Sint8 volume) {
+    double part = 0;
+    for (int i = 0; i < BUFFER; i++) {
+        part = fmod(*wave_part + i, tone);
+        audio[i] += legacy(wave, part, tone) * volume;
+    }
+    *wave_part = part;
+}
+
+/* Largest difference between the two, and how many samples differ by more
+ * than 1e-4 (those can only be edge samples of a discontinuity)
+ */
+static void compare(WaveForm wave, double *max_err, int *edges) {
+    static float out[BUFFER];
+    *max_err = 0;
+    *edges = 0;
+    for (int f = 0; f < (int)SDL_arraysize(freqs); f++) {
+        double tone = RATE / freqs[f];
+        Osc osc = { 0 };
+        setOscFreq(&osc, freqs[f], RATE);
+        for (int b = 0; b < RATE / BUFFER; b++) {
+            renderOsc(&osc, wave, out, BUFFER);
+            for (int i = 0; i < BUFFER; i++) {
+                double part = fmod((double)b * BUFFER + i, tone);
+                double err = fabs(out[i] - legacy(wave, part, tone));
+                if (err > 1e-4) {
+                    *edges += 1;
+                } else if (err > *max_err) {
+                    *max_err = err;
+                }
+            }
+        }
+    }
+}
+
+static const char *kernel_names[] = {
+    "square", "triangle", "saw", "sine", "opl2_1", "opl2_2", "opl2_3",
+    "squareBL", "triangleBL", "sawBL", "wavetable", "noise",
+    "add", "addRamp", "gain", "toS8", "toS16", "toS32", "toF32", "spread",
+    "peak", "gainRamp", "energy", "mulAdd"
+};
+static const WaveForm kernel_waves[] = {
+    square, triangle, saw, sine, opl2_1, opl2_2, opl2_3
+};
+static const WaveForm kernel_bleps[] = { square, triangle, saw };
+#define KERNELS ((int)SDL_arraysize(kernel_names))
+#define OSC_KERNELS ((int)(SDL_arraysize(kernel_waves) + \
+            SDL_arraysize(kernel_bleps) + 2))
+
+// odd length, so the scalar tails of the vector loops get used too
+#define KLEN (BUFFER - 3)
+
+static float input[BUFFER];
+static float work[BUFFER];
+static float out_f[BUFFER];
+static Sint16 out_s16[BUFFER];
+static Sint32 out_s32[BUFFER];
+static float out_stereo[BUFFER * 2];
+static Sint8 out_s8[BUFFER];
+static float out_peak;
+static float table[TABLE_LEN + 1];
+
+/* Runs kernel k once on the current dsp, returns where its output went
+ */
+static void *runKernel(int k) {
+    if (k < (int)SDL_arraysize(kernel_waves)) {
+        dsp->osc[kernel_waves[k]](out_f, 0.3f, 440.0f / RATE, KLEN);
+        return out_f;
+    } else if (k < OSC_KERNELS - 2) {
+        WaveForm w = kernel_bleps[k - SDL_arraysize(kernel_waves)];
+        dsp->blep[w](out_f, 0.3f, 2000.0f / RATE, KLEN);
+        return out_f;
+    } else if (k == OSC_KERNELS - 2) {
+        dsp->wavetable(out_f, table, 0.3f, 440.0f / RATE, KLEN);
+        return out_f;
+    } else if (k == OSC_KERNELS - 1) {
+        Uint32 state[NOISE_LANES];
+        for (int l = 0; l < NOISE_LANES; l++) {
+            state[l] = l + 1;
+        }
+        dsp->noise(state, out_f, KLEN);
+        return out_f;
+    }
+    switch (k - OSC_KERNELS) {
+        case 0:
+            dsp->add(work, input, KLEN);
+            return work;
+        case 1:
+            dsp->addRamp(work, input, KLEN, 0.2f, 0.0007f);
+            return work;
+        case 2:
+            dsp->gain(work, 0.999f, KLEN);
+            return work;
+        case 3:
+            dsp->toS8(out_s8, input, KLEN);
+            return out_s8;
+        case 4:
+            dsp->toS16(out_s16, input, KLEN);
+            return out_s16;
+        case 5:
+            dsp->toS32(out_s32, input, KLEN);
+            return out_s32;
+        case 6:
+            dsp->toF32(out_f, input, KLEN);
+            return out_f;
+        case 7:
+            dsp->spread(out_stereo, input, KLEN, 2);
+            return out_stereo;
+        case 8:
+            out_peak = dsp->peak(input, KLEN);
+            return &out_peak;
+        case 9:
+            dsp->gainRamp(work, KLEN, 0.999f, 1e-6f);
+            return work;
+        case 10:
+            out_peak = dsp->energy(input, KLEN);
+            return &out_peak;
+        default:
+            dsp->multiplyAdd(work, out_stereo, input, table, table + 1,
+                    input, KLEN);
+            return work;
+    }
+}
+
+static size_t kernelBytes(int k) {
+    int conv = k - OSC_KERNELS;
+    if (conv == 3) {
+        return KLEN;
+    } else if (conv == 4) {
+        return KLEN * sizeof(Sint16);
+    } else if (conv == 7) {
+        return KLEN * 2 * sizeof(float);
+    } else if (conv == 8 || conv == 10) {
+        return sizeof(float);
+    }
+    return KLEN * sizeof(float);
+}
+
+/* Cost per sample of kernel k, and if its output matches the reference
+ */
+static double timeKernel(int k, const void *reference, bool *same) {
+    SDL_memcpy(work, input, sizeof(work));
+    void *out = runKernel(k);
+    *same = reference == NULL ||
+        SDL_memcmp(out, reference, kernelBytes(k)) == 0;
+
+    Uint64 start = ticks();
+    for (int b = 0; b < BUFFERS; b++) {
+        runKernel(k);
+    }
+    return (double)(ticks() - start) / ((double)BUFFERS * KLEN);
+}
+
+static void benchKernels() {
+    static Uint8 reference[KERNELS][BUFFER * 2 * sizeof(float)];
+    const char *isas[] = { "scalar", "sse2", "avx2" };
+    double scalar_cost[KERNELS];
+
+    // a bit over full scale, so the converters have something to clamp
+    for (int i = 0; i < BUFFER; i++) {
+        input[i] = 1.5f * sin(i * 0.01) * cos(i * 0.37);
+    }
+    for (int i = 0; i <= TABLE_LEN; i++) {
+        table[i] = sin(2 * M_PI * i / TABLE_LEN);
+    }
+
+    printf("\n%-10s %7s %14s %8s %9s\n", "kernel", "isa",
+            UNIT "/smp", "speedup", "identical");
+    for (int isa = 0; isa < (int)SDL_arraysize(isas); isa++) {
+        if (!selectKernels(isas[isa])) {
+            printf("%-10s %7s %14s\n", "-", isas[isa], "not supported");
+            continue;
+        }
+        for (int k = 0; k < KERNELS; k++) {
+            bool same;
+            double cost = timeKernel(k, isa ? reference[k] : NULL, &same);
+            if (isa == 0) {
+                scalar_cost[k] = cost;
+                SDL_memcpy(work, input, sizeof(work));
+                SDL_memcpy(reference[k], runKernel(k), kernelBytes(k));
+            }
+            printf("%-10s %7s %14.2f %7.1fx %9s\n", kernel_names[k],
+                    isas[isa], cost, scalar_cost[k] / cost,
+                    same ? "yes" : "NO");
+        }
+    }
+    setupKernels();
+}
+
+/* The way a render loop looks without specialized kernels: one loop for all
+ * wave forms, deciding per sample which one it is rendering. wave is
+ * volatile because the global it stands for may change under the loop.
+ */
+static void genericOsc(volatile WaveForm *wave, float *out, float start,
+        float inc, int len) {
+    for (int i = 0; i < len; i++) {
+        float p = phaseAt(start, inc, i);
+        switch (*wave) {
+            case square:
+                out[i] = squareAt(p);
+                break;
+            case triangle:
+                out[i] = triangleAt(p);
+                break;
+            case saw:
+                out[i] = sawAt(p);
+                break;
+            case sine:
+                out[i] = sinTurn(p);
+                break;
+            case opl2_1:
+                out[i] = opl21At(p);
+                break;
+            case opl2_2:
+                out[i] = opl22At(p);
+                break;
+            case opl2_3:
+                out[i] = opl23At(p);
+                break;
+            default:
+                out[i] = 0;
+        }
+    }
+}
+
+/* The generic loop against the kernel specialized for the wave form, picked
+ * once per buffer, both scalar and with the best instruction set the CPU
+ * has. The speedup is of the latter over the generic loop.
+ */
+static void benchDispatch() {
+    static float out[BUFFER];
+    bool was = band_limited;
+    band_limited = false; // the generic loop has no band-limiting either
+
+    printf("\n%-9s %18s %18s %18s %8s\n", "wave", "generic " UNIT "/smp",
+            "scalar " UNIT "/smp", "best " UNIT "/smp", "speedup");
+    for (int w = square; w <= opl2_3; w++) {
+        if (w == noise) {
+            continue;
+        }
+        volatile WaveForm current = w;
+        Uint64 cost[3];
+        for (int path = 0; path < 3; path++) {
+            const char *name = dsp->name;
+            if (path == 1) {
+                selectKernels("scalar");
+            }
+            Osc osc = { 0 };
+            setOscFreq(&osc, 440, RATE);
+            Uint64 start = ticks();
+            for (int b = 0; b < BUFFERS; b++) {
+                if (path == 0) {
+                    genericOsc(&current, out, osc.phase, osc.inc, BUFFER);
+                } else {
+                    OscKernel kernel = oscKernel(current);
+                    kernel(out, osc.phase, osc.inc, BUFFER);
+                }
+                osc.phase += osc.inc * BUFFER;
+                osc.phase -= (int)osc.phase;
+            }
+            cost[path] = ticks() - start;
+            if (path == 1) {
+                selectKernels(name);
+            }
+        }
+        double samples = (double)BUFFERS * BUFFER;
+        printf("%-9s %18.2f %18.2f %18.2f %7.1fx\n", wave_names[w],
+                cost[0] / samples, cost[1] / samples, cost[2] / samples,
+                (double)cost[0] / cost[2]);
+    }
+    band_limited = was;
+}
+
+// a high note for the aliasing test: C7 is about 2093 Hz, this is the
+// nearest frequency that fits a whole number of periods into ALIAS_LEN
+#define ALIAS_LEN 4096
+#define ALIAS_BIN 194
+#define ALIAS_FREQ ((double)ALIAS_BIN * RATE / ALIAS_LEN)
+#define OS_TAPS 32      // FIR taps per factor of oversampling
+
+/* Decimating lowpass for the oversampling workaround: a Blackman windowed
+ * sinc with its cutoff just under the Nyquist frequency of the output.
+ */
+static void designFir(float *fir, int taps, int factor) {
+    double cutoff = 0.45 / factor;
+    double sum = 0;
+    for (int n = 0; n < taps; n++) {
+        double x = n - (taps - 1) / 2.0;
+        double sinc = x == 0 ? 2 * cutoff :
+            sin(2 * M_PI * cutoff * x) / (M_PI * x);
+        double window = 0.42 - 0.5 * cos(2 * M_PI * n / (taps - 1)) +
+            0.08 * cos(4 * M_PI * n / (taps - 1));
+        fir[n] = sinc * window;
+        sum += fir[n];
+    }
+    for (int n = 0; n < taps; n++) {
+        fir[n] /= sum;
+    }
+}
+
+/* Renders len samples of a wave, either directly (factor 1) or factor times
+ * over at the higher rate and filtered back down, the way the piano had to
+ * be run to keep high notes clean. hist keeps the last taps - 1 samples of
+ * the high rate signal between calls.
+ */
+static void renderOversampled(Osc *osc, WaveForm wave, int factor,
+        const float *fir, float *hist, float *out, int len) {
+    static float high[OS_TAPS * 8 + BUFFER * 8];
+    int taps = OS_TAPS * factor;
+    if (factor == 1) {
+        renderOsc(osc, wave, out, len);
+        return;
+    }
+    SDL_memcpy(high, hist, sizeof(float) * (taps - 1));
+    renderOsc(osc, wave, high + taps - 1, len * factor);
+    for (int i = 0; i < len; i++) {
+        const float *x = high + i * factor;
+        float y = 0;
+        for (int t = 0; t < taps; t++) {
+            y += fir[t] * x[t];
+        }
+        out[i] = y;
+    }
+    SDL_memcpy(hist, high + len * factor, sizeof(float) * (taps - 1));
+}
+
+/* How loud the aliases are against the harmonics, in dB. The note's
+ * harmonics all fall exactly on multiples of ALIAS_BIN, whatever is not
+ * there (or DC) is aliasing.
+ */
+static double aliasLevel(const float *x) {
+    double total = 0;
+    double mean = 0;
+    for (int i = 0; i < ALIAS_LEN; i++) {
+        mean += x[i];
+    }
+    mean /= ALIAS_LEN;
+    for (int i = 0; i < ALIAS_LEN; i++) {
+        total += (x[i] - mean) * (x[i] - mean);
+    }
+    total /= ALIAS_LEN;
+
+    double harmonics = 0;
+    for (int bin = ALIAS_BIN; bin < ALIAS_LEN / 2; bin += ALIAS_BIN) {
+        double re = 0;
+        double im = 0;
+        for (int i = 0; i < ALIAS_LEN; i++) {
+            double a = 2 * M_PI * (double)bin * i / ALIAS_LEN;
+            re += x[i] * cos(a);
+            im -= x[i] * sin(a);
+        }
+        harmonics += 2 * (re * re + im * im) / ((double)ALIAS_LEN * ALIAS_LEN);
+    }
+    double aliases = total - harmonics;
+    return 10 * log10((aliases > 1e-20 ? aliases : 1e-20) / harmonics);
+}
+
+/* Compares the naive oscillators, the band-limited ones and the naive ones
+ * oversampled 2, 4 and 8 times for a note near C7
+ */
+static void benchAliasing() {
+    static float out[ALIAS_LEN + BUFFER];
+    static float fir[OS_TAPS * 8];
+    static float hist[OS_TAPS * 8];
+    const WaveForm waves[] = { square, triangle, saw };
+    const char *methods[] = { "naive", "polyblep", "2x over", "4x over",
+        "8x over" };
+    const int factors[] = { 1, 1, 2, 4, 8 };
+
+    printf("\n%-9s %-9s %14s %12s\n", "wave", "method", UNIT "/smp",
+            "aliases dB");
+    for (int w = 0; w < (int)SDL_arraysize(waves); w++) {
+        for (int m = 0; m < (int)SDL_arraysize(methods); m++) {
+            int factor = factors[m];
+            Osc osc = { 0 };
+            band_limited = m == 1;
+            designFir(fir, OS_TAPS * factor, factor);
+            SDL_memset(hist, 0, sizeof(hist));
+            setOscFreq(&osc, ALIAS_FREQ, RATE * factor);
+
+            // one buffer to fill the filter, then the one that is measured
+            renderOversampled(&osc, waves[w], factor, fir, hist, out, BUFFER);
+            for (int i = 0; i < ALIAS_LEN; i += BUFFER) {
+                renderOversampled(&osc, waves[w], factor, fir, hist,
+                        out + i, BUFFER);
+            }
+            double level = aliasLevel(out);
+
+            Uint64 start = ticks();
+            for (int b = 0; b < BUFFERS / 10; b++) {
+                renderOversampled(&osc, waves[w], factor, fir, hist,
+                        out, BUFFER);
+            }
+            double cost = (double)(ticks() - start) / (BUFFERS / 10 * BUFFER);
+            printf("%-9s %-9s %14.2f %12.1f\n", wave_names[waves[w]],
+                    methods[m], cost, level);
+        }
+    }
+    band_limited = true;
+}
+
+/* The wave table cache against rendering every sample: what building the
+ * tables of a wave costs once, and then what a voice costs per sample either
+ * way, for the keys of the piano
+ */
+static void benchTables() {
+    static float out[BUFFER];
+    WaveTables tables;
+    const int notes = 61;
+    const int first = 36; // C2 to C7, as the piano has them
+
+    setupWaveTables(&tables, RATE);
+    for (int n = first; n < first + notes; n++) {
+        addTableNote(&tables, n, 440 * pow(2, (n - 69) / 12.0));
+    }
+    printf("\n%-9s %10s %20s %20s %8s\n", "wave", "build ms",
+            "analytic " UNIT "/smp", "table " UNIT "/smp", "speedup");
+    for (int w = square; w <= sine; w++) { // FM wave forms have no tables
+        if (w == noise) {
+            continue;
+        }
+        Uint64 start = SDL_GetPerformanceCounter();
+        buildWaveTables(&tables, w);
+        double build = (double)(SDL_GetPerformanceCounter() - start) /
+            SDL_GetPerformanceFrequency();
+
+        Uint64 analytic = 0;
+        Uint64 cached = 0;
+        for (int n = first; n < first + notes; n++) {
+            Osc osc = { 0 };
+            setOscFreq(&osc, tables.freq[n], RATE);
+            start = ticks();
+            for (int b = 0; b < BUFFERS / 40; b++) {
+                renderOsc(&osc, w, out, BUFFER);
+            }
+            analytic += ticks() - start;
+            start = ticks();
+            for (int b = 0; b < BUFFERS / 40; b++) {
+                renderTable(&osc, waveTable(&tables, w, n), out, BUFFER);
+            }
+            cached += ticks() - start;
+        }
+        double samples = (double)notes * (BUFFERS / 40) * BUFFER;
+        printf("%-9s %10.1f %20.2f %20.2f %7.1fx\n", wave_names[w],
+                build * 1000, analytic / samples, cached / samples,
+                (double)analytic / cached);
+    }
+    printf("tables take %.1f KiB, the budget is %d KiB\n",
+            tables.used / 1024.0, TABLE_BUDGET / 1024);
+    freeWaveTables(&tables);
+}
+
+/* The whole engine, as the audio callback runs it: nanoseconds per sample
+ * of output and per voice, for every wave form and a few polyphonies
+ */
+static void benchEngine() {
+    static const int voices[] = { 1, 8, 32, 61 };
+    static Uint8 out[BUFFER * sizeof(float)];
+    Key white[36];
+    Key black[25];
+    Keys keys;
+    keys.white = white;
+    keys.w_len = 36;
+    keys.black = black;
+    keys.b_len = 25;
+    setupKeys(&keys, 'C', 2, 'C', 7);
+
+    SDL_AudioSpec spec;
+    SDL_memset(&spec, 0, sizeof(spec));
+    spec.freq = RATE;
+    spec.format = AUDIO_F32SYS;
+    spec.channels = 1;
+    spec.samples = BUFFER;
+    polyphony = NOTES;
+    band_limited = true;
+
+    printf("\n%-9s", "ns/smp");
+    for (int v = 0; v < (int)SDL_arraysize(voices); v++) {
+        printf(" %7d voices", voices[v]);
+    }
+    printf(" %10s\n", "per voice");
+    double freq = (double)SDL_GetPerformanceFrequency();
+    for (int w = square; w <= opl2_3; w++) {
+        double per_voice = 0;
+        wave = w;
+        printf("%-9s", wave_names[w]);
+        for (int v = 0; v < (int)SDL_arraysize(voices); v++) {
+            Engine engine;
+            if (!setupEngine(&engine, &keys, &spec)) {
+                printf("out of memory\n");
+                freeEngine(&engine);
+                return;
+            }
+            // the keys stay down, so every voice sounds throughout
+            for (int k = 0; k < voices[v]; k++) {
+                NoteEvent ev = { 0, k < 36 ? &white[k] : &black[k - 36], true,
+                    FULL_VELOCITY };
+                applyEvent(&engine, &ev);
+            }
+            Uint64 start = SDL_GetPerformanceCounter();
+            for (int b = 0; b < BUFFERS / 10; b++) {
+                renderAudio(&engine, out, sizeof(out));
+            }
+            double ns = (SDL_GetPerformanceCounter() - start) / freq * 1e9 /
+                ((double)BUFFERS / 10 * BUFFER);
+            per_voice = ns / voices[v];
+            printf(" %14.2f", ns);
+            freeEngine(&engine);
+        }
+        printf(" %10.2f\n", per_voice);
+    }
+    wave = square;
+}
+
+/* Two operator FM with float phases and sinf, as the FM voices would be
+ * without the chip's tables: what renderFm is measured against
+ */
+static void floatFm(float *phase, float inc, float *last, float *out,
+        int len) {
+    const float tau = 2 * (float)M_PI;
+    for (int i = 0; i < len; i++) {
+        float m = 0.5f * sinf(tau * phase[0] + 0.25f * *last);
+        *last = m;
+        out[i] = sinf(tau * phase[1] + 2 * tau * m);
+        phase[0] += inc;
+        phase[1] += inc;
+        phase[0] -= phase[0] >= 1 ? 1 : 0;
+        phase[1] -= phase[1] >= 1 ? 1 : 0;
+    }
+}
+
+/* Every key of the piano at once (61 voices), rendered with the float
+ * kernel the OPL2 wave forms had before they were FM (a single clipped
+ * sine), with float FM and with the fixed point FM of fm.c
+ */
+static void benchFm() {
+    static float out[BUFFER];
+    const int notes = 61;
+    const int first = 36; // C2 to C7
+    static FmVoice fm[61];
+    static Osc osc[61];
+    float phase[61][2];
+    float last[61];
+    setupFm();
+
+    printf("\n%-9s %14s %14s %14s\n", "61 keys", "float osc",
+            "float FM", "fixed FM");
+    for (int w = opl2_1; w <= opl2_3; w++) {
+        const FmPatch *patch = fmPatch(w);
+        OscKernel kernel = oscKernel(w);
+        Uint64 t[3] = { 0, 0, 0 };
+        for (int n = 0; n < notes; n++) {
+            double freq = 440 * pow(2, (first + n - 69) / 12.0);
+            SDL_memset(&osc[n], 0, sizeof(Osc));
+            setOscFreq(&osc[n], freq, RATE);
+            phase[n][0] = phase[n][1] = 0;
+            last[n] = 0;
+            resetFm(&fm[n]);
+            attackFm(&fm[n]);
+        }
+        for (int b = 0; b < BUFFERS / 20; b++) {
+            for (int n = 0; n < notes; n++) {
+                double freq = 440 * pow(2, (first + n - 69) / 12.0);
+                Uint64 start = ticks();
+                runOsc(&osc[n], kernel, out, BUFFER);
+                Uint64 mid = ticks();
+                floatFm(phase[n], (float)(freq / RATE), &last[n], out,
+                        BUFFER);
+                Uint64 fixed = ticks();
+                renderFm(&fm[n], patch, freq, RATE, out, BUFFER);
+                Uint64 end = ticks();
+                t[0] += mid - start;
+                t[1] += fixed - mid;
+                t[2] += end - fixed;
+            }
+        }
+        double samples = (double)notes * (BUFFERS / 20) * BUFFER;
+        printf("%-9s %14.2f %14.2f %14.2f " UNIT "/smp per voice\n",
+                wave_names[w], t[0] / samples, t[1] / samples,
+                t[2] / samples);
+    }
+}
+
+/* The reverb on one buffer after the other, for impulse responses of 0.5
+ * to 5 s, with blocks of a small buffer and of the default one. The load
+ * is the share of the buffer's playing time that goes into it.
+ */
+static void benchReverb() {
+    static const double seconds[] = { 0.5, 1, 2, 3, 4, 5 };
+    static const int blocks[] = { 256, BUFFER };
+    static float audio[BUFFER];
+    int len = 5 * RATE;
+    float *ir = SDL_malloc(sizeof(float) * len);
+    if (ir == NULL) {
+        return;
+    }
+    // a room: noise dying away by 60 dB in about 2 s
+    Uint32 x = 1;
+    for (int i = 0; i < len; i++) {
+        x = xorshift(x);
+        ir[i] = noiseAt(x) * 1e-3f * expf(-3.5f * i / RATE);
+    }
+
+    printf("\n%-9s %23s %23s\n", "reverb", "256 frames", "1024 frames");
+    printf("%-9s %6s %9s %6s %6s %9s %6s\n", "ir", "parts", "us/buffer",
+            "load", "parts", "us/buffer", "load");
+    for (int s = 0; s < (int)SDL_arraysize(seconds); s++) {
+        printf("%5.1f s  ", seconds[s]);
+        for (int b = 0; b < (int)SDL_arraysize(blocks); b++) {
+            int frames = blocks[b];
+            Reverb *r = newReverb(ir, (int)(seconds[s] * RATE), frames);
+            if (r == NULL) {
+                printf(" %22s", "out of memory");
+                continue;
+            }
+            int buffers = BUFFERS / 10 * BUFFER / frames;
+            Uint64 start = SDL_GetPerformanceCounter();
+            for (int n = 0; n < buffers; n++) {
+                for (int i = 0; i < frames; i++) {
+                    x = xorshift(x);
+                    audio[i] = noiseAt(x) * 0.01f;
+                }
+                r->effect.process(&r->effect, audio, frames);
+            }
+            double took = (double)(SDL_GetPerformanceCounter() - start) /
+                SDL_GetPerformanceFrequency() / buffers;
+            printf(" %6d %9.1f %5.1f%%", r->parts, took * 1e6,
+                    took * RATE / frames * 100);
+            r->effect.destroy(&r->effect);
+        }
+        printf("\n");
+    }
+    SDL_free(ir);
+}
+
+#ifdef __linux__
+/* Sends notes one at a time through a FIFO and the MIDI input thread, which
+ * sleeps in between as it would waiting for a player, and measures how long
+ * each takes to reach the engine's queue. The audio thread then plays it
+ * exactly one buffer after it was read, see renderAudio: piano logs that
+ * part on exit.
+ */
+static void benchMidi() {
+    Key white[36];
+    Key black[25];
+    Keys keys;
+    keys.white = white;
+    keys.w_len = 36;
+    keys.black = black;
+    keys.b_len = 25;
+    setupKeys(&keys, 'C', 2, 'C', 7);
+    SDL_AudioSpec spec;
+    SDL_memset(&spec, 0, sizeof(spec));
+    spec.freq = RATE;
+    spec.format = AUDIO_F32SYS;
+    spec.channels = 1;
+    spec.samples = BUFFER;
+    Engine engine;
+    if (!setupEngine(&engine, &keys, &spec)) {
+        printf("out of memory\n");
+        freeEngine(&engine);
+        return;
+    }
+
+    remove(MIDI_FIFO);
+    MidiInput *midi = NULL;
+    int fd = -1;
+    if (mkfifo(MIDI_FIFO, 0600) < 0 ||
+            (midi = openMidi(MIDI_FIFO, &engine)) == NULL ||
+            (fd = open(MIDI_FIFO, O_WRONLY)) < 0) {
+        printf("\nno FIFO for MIDI\n");
+    }
+    static Histogram hist;
+    resetHistogram(&hist);
+    double freq = (double)SDL_GetPerformanceFrequency();
+    for (int n = 0; fd >= 0 && n < MIDI_NOTES; n++) {
+        Uint8 msg[3] = { 0x90, 60, n % 2 ? 0 : 100 };
+        NoteEvent ev;
+        SDL_Delay(1);
+        Uint64 start = SDL_GetPerformanceCounter();
+        if (write(fd, msg, sizeof(msg)) != (ssize_t)sizeof(msg)) {
+            break;
+        }
+        while (!peekEvent(&engine.midi, &ev)) {
+        }
+        addDuration(&hist, (SDL_GetPerformanceCounter() - start) / freq);
+        popEvent(&engine.midi);
+    }
+    if (hist.count) {
+        printf("\nMIDI byte written to event queued: %u notes, "
+                "%.1f/%.1f/%.1f us (50/99/max)\n", hist.count,
+                percentile(&hist, 50) * 1e6, percentile(&hist, 99) * 1e6,
+                hist.max * 1e6);
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    closeMidi(midi);
+    remove(MIDI_FIFO);
+    freeEngine(&engine);
+}
+#endif
+
+int main() {
+    static Sint32 audio[BUFFER];
+    static float voice[BUFFER];
+    Sint8 volume = 10;
+
+    setupKernels();
+
+    // this part compares the shapes with the old code, which was not
+    // band-limited either
+    band_limited = false;
+    printf("%-9s %14s %14s %8s %10s %6s\n", "wave", "fmod " UNIT "/smp",
+            "phase " UNIT "/smp", "speedup", "max err", "edges");
+    for (int w = square; w <= opl2_3; w++) {
+        Uint64 old_ticks = 0;
+        Uint64 new_ticks = 0;
+        for (int f = 0; f < (int)SDL_arraysize(freqs); f++) {
+            double wave_part = 0;
+            double tone = RATE / freqs[f];
+            Uint64 start = ticks();
+            for (int b = 0; b < BUFFERS; b++) {
+                legacyBuffer(w, audio, &wave_part, tone, volume);
+            }
+            old_ticks += ticks() - start;
+
+            Osc osc = { 0 };
+            setOscFreq(&osc, freqs[f], RATE);
+            seedNoise(&osc, 0);
+            start = ticks();
+            for (int b = 0; b < BUFFERS; b++) {
+                renderOsc(&osc, w, voice, BUFFER);
+                for (int i = 0; i < BUFFER; i++) {
+                    audio[i] += voice[i] * volume;
+                }
+            }
+            new_ticks += ticks() - start;
+        }
+        double samples = (double)SDL_arraysize(freqs) * BUFFERS * BUFFER;
+        double max_err;
+        int edges;
+        compare(w, &max_err, &edges);
+        if (w == noise) {
+            printf("%-9s %14.2f %14.2f %7.1fx %10s %6s\n", wave_names[w],
+                    old_ticks / samples, new_ticks / samples,
+                    (double)old_ticks / new_ticks, "-", "-");
+        } else {
+            printf("%-9s %14.2f %14.2f %7.1fx %10.2e %6d\n", wave_names[w],
+                    old_ticks / samples, new_ticks / samples,
+                    (double)old_ticks / new_ticks, max_err, edges);
+        }
+    }
+    benchKernels();
+    benchDispatch();
+    benchAliasing();
+    benchTables();
+    benchEngine();
+    benchFm();
+    benchReverb();
+#ifdef __linux__
+    benchMidi();
+#endif
+
+    // keep the compiler from throwing the work away
+    return audio[0] == 12345;
+}
@@ -0,0 +1,298 @@
+#ifdef __linux__
+#include <errno.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+#include <stdio.h>
+#include "config.h"
+
+/* The config file is plain .ini, '#' or ';' start a comment unless the '#'
+ * is part of a black key's name:
+ *
+ *     [tuning]
+ *     a4 = 432         ; Hz
+ *
+ *     [sound]
+ *     wave = sine      # what the piano starts with
+ *     volume = 10      # 1 to 127
+ *
+ *     [keys]
+ *     C4 = t           # the keycode that plays C4
+ *     C4# = t          # and with shift, C4#
+ *
+ * A [keys] section replaces all built-in bindings, so it has to list every
+ * key that should be played from the keyboard. A file that is not there
+ * counts as an empty one.
+ *
+ * The piano watches the file (with inotify, on Linux) and applies what
+ * changed whenever it is saved, on the main thread: a new A4 retunes the
+ * keys and swaps the audio thread's tuning in one go, without stopping the
+ * device or the notes that are sounding, see retune.
+ */
+
+/* The config the program has without a file: the tuning, wave form and
+ * volume it starts with and the built-in bindings
+ */
+void defaultConfig(Config *config) {
+    extern double A4;
+    extern WaveForm wave;
+    extern Sint8 volume;
+    SDL_memset(config, 0, sizeof(*config));
+    config->a4 = A4;
+    config->wave = wave;
+    config->volume = volume;
+    SDL_memcpy(config->bindings, key_bindings, sizeof(key_bindings));
+    config->b_len = KEY_BINDINGS;
+}
+
+// cuts blanks off both ends of s, in place
+static char *trim(char *s) {
+    while (SDL_isspace((unsigned char)*s)) {
+        s++;
+    }
+    char *end = s + SDL_strlen(s);
+    while (end > s && SDL_isspace((unsigned char)end[-1])) {
+        *--end = 0;
+    }
+    return s;
+}
+
+/* Reads one name = value line of section into config. Returns false if it
+ * makes no sense.
+ */
+static bool readSetting(const char *section, const char *name,
+        const char *value, Keys *keys, Config *config) {
+    char *end;
+    if (SDL_strcmp(section, "tuning") == 0 && SDL_strcasecmp(name, "a4") == 0) {
+        double a4 = SDL_strtod(value, &end);
+        config->a4 = a4;
+        return *end == 0 && a4 >= 100 && a4 <= 1000;
+    }
+    if (SDL_strcmp(section, "sound") == 0 && SDL_strcmp(name, "wave") == 0) {
+        return parseWave(value, &config->wave);
+    }
+    if (SDL_strcmp(section, "sound") == 0 && SDL_strcmp(name, "volume") == 0) {
+        long v = SDL_strtol(value, &end, 10);
+        config->volume = (Sint8)v;
+        return *end == 0 && v >= 1 && v <= 127;
+    }
+    if (SDL_strcmp(section, "keys") == 0) {
+        // keycodes of letters are lower case, whatever the file says
+        char c = (char)SDL_tolower((unsigned char)value[0]);
+        if (findKey(keys, name) == NULL || SDL_strlen(value) != 1 ||
+                c <= ' ' || c >= KEY_CHARS - 1 ||
+                config->b_len == MAX_BINDINGS) {
+            return false;
+        }
+        Binding *b = &config->bindings[config->b_len++];
+        SDL_snprintf(b->tone, sizeof(b->tone), "%s", name);
+        b->key = c;
+        return true;
+    }
+    return false;
+}
+
+/* Reads the config file at path over what config has. On an error it says
+ * where and returns false, and config is left as it was.
+ */
+bool readConfig(const char *path, Keys *keys, Config *config) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return true; // nothing to change
+    }
+
+    Config next = *config;
+    char section[16] = "";
+    char line[256];
+    bool ok = true;
+    bool bound = false; // whether the built-in bindings are gone yet
+    for (int n = 1; ok && fgets(line, sizeof(line), f); n++) {
+        // a comment starts at a '#' or ';' at the start of a line or after
+        // a blank, the '#' in black key names like C4# does not count
+        for (char *c = line; *c; c++) {
+            if ((*c == '#' || *c == ';') &&
+                    (c == line || SDL_isspace((unsigned char)c[-1]))) {
+                *c = 0;
+                break;
+            }
+        }
+        char *s = trim(line);
+        char *eq = SDL_strchr(s, '=');
+        if (*s == 0) {
+            continue;
+        } else if (*s == '[') {
+            char *close = SDL_strchr(s, ']');
+            ok = close != NULL && close[1] == 0 &&
+                close - s - 1 < (int)sizeof(section);
+            if (ok) {
+                *close = 0;
+                SDL_snprintf(section, sizeof(section), "%s", trim(s + 1));
+                ok = SDL_strcmp(section, "tuning") == 0 ||
+                    SDL_strcmp(section, "sound") == 0 ||
+                    SDL_strcmp(section, "keys") == 0;
+            }
+        } else if (eq == NULL) {
+            ok = false;
+        } else {
+            *eq = 0;
+            if (SDL_strcmp(section, "keys") == 0 && !bound) {
+                next.b_len = 0;
+                bound = true;
+            }
+            ok = readSetting(section, trim(s), trim(eq + 1), keys, &next);
+        }
+        if (!ok) {
+            printf("%s:%d: cannot make sense of this line\n", path, n);
+        }
+    }
+    fclose(f);
+
+    if (ok) {
+        *config = next;
+    }
+    return ok;
+}
+
+static bool sameBindings(const Config *a, const Config *b) {
+    if (a->b_len != b->b_len) {
+        return false;
+    }
+    for (int i = 0; i < a->b_len; i++) {
+        if (a->bindings[i].key != b->bindings[i].key ||
+                SDL_strcmp(a->bindings[i].tone, b->bindings[i].tone) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Makes a config take effect. old is the config that took effect last, and
+ * only what the new one changes is applied, so that a wave form or volume
+ * picked on the keyboard since stays unless the file sets another; NULL
+ * applies everything. Before there is an engine (engine NULL) retuning only
+ * takes the keys, afterwards the audio thread gets the new tuning through
+ * retune. Main thread only. Returns false if there was not enough memory
+ * to retune, everything else is changed even so.
+ */
+bool applyConfig(const Config *config, const Config *old, Keys *keys,
+        Engine *engine) {
+    extern double A4;
+    extern WaveForm wave;
+    extern Sint8 volume;
+    bool ok = true;
+    if (config->a4 != A4 && engine) {
+        ok = retune(engine, config->a4);
+    } else if (config->a4 != A4) {
+        A4 = config->a4;
+        tuneKeys(keys, A4);
+    }
+    if (old == NULL || config->wave != old->wave) {
+        wave = config->wave;
+        if (engine && wave_tables) {
+            buildWaveTables(&engine->tables, wave);
+        }
+    }
+    if (old == NULL || config->volume != old->volume) {
+        volume = config->volume;
+    }
+    if (old == NULL || !sameBindings(config, old)) {
+        bindKeys(keys, config->bindings, config->b_len);
+    }
+    return ok;
+}
+
+#ifdef __linux__
+static int watchMain(void *arg) {
+    ConfigWatch *watch = arg;
+    _Alignas(struct inotify_event) char buf[4096];
+
+    for (;;) {
+        ssize_t len = read(watch->fd, buf, sizeof(buf));
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+        if (len <= 0) {
+            return 0;
+        }
+        // one event however many the editor caused in one go
+        bool changed = false;
+        for (char *p = buf; p < buf + len; ) {
+            struct inotify_event *ev = (struct inotify_event*)p;
+            if (ev->mask & IN_IGNORED) {
+                return 0; // the watch is gone, see stopWatching
+            }
+            if (ev->len > 0 && SDL_strcmp(ev->name, watch->name) == 0) {
+                changed = true;
+            }
+            p += sizeof(*ev) + ev->len;
+        }
+        if (changed) {
+            SDL_Event event;
+            SDL_memset(&event, 0, sizeof(event));
+            event.type = watch->event;
+            SDL_PushEvent(&event);
+        }
+    }
+}
+#endif
+
+/* Starts watching the file at path, which need not be there yet. Returns
+ * NULL if it cannot be watched, on systems without inotify always.
+ */
+ConfigWatch *watchConfig(const char *path, Uint32 event) {
+#ifdef __linux__
+    ConfigWatch *watch = SDL_malloc(sizeof(ConfigWatch));
+    if (watch == NULL) {
+        return NULL;
+    }
+    char dir[256];
+    const char *slash = SDL_strrchr(path, '/');
+    if (slash) {
+        SDL_snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path + 1), path);
+    } else {
+        SDL_snprintf(dir, sizeof(dir), ".");
+    }
+    SDL_snprintf(watch->name, sizeof(watch->name), "%s",
+            slash ? slash + 1 : path);
+    watch->event = event;
+    watch->thread = NULL;
+    watch->wd = -1;
+    watch->fd = inotify_init1(IN_CLOEXEC);
+    if (watch->fd >= 0) {
+        watch->wd = inotify_add_watch(watch->fd, dir,
+                IN_CLOSE_WRITE | IN_MOVED_TO);
+    }
+    if (watch->wd >= 0) {
+        watch->thread = SDL_CreateThread(watchMain, "config", watch);
+    }
+    if (watch->thread == NULL) {
+        if (watch->fd >= 0) {
+            close(watch->fd);
+        }
+        SDL_free(watch);
+        return NULL;
+    }
+    return watch;
+#else
+    (void)path;
+    (void)event;
+    return NULL;
+#endif
+}
+
+/* Stops the watching thread and frees the watch, NULL is fine
+ */
+void stopWatching(ConfigWatch *watch) {
+#ifdef __linux__
+    if (watch == NULL) {
+        return;
+    }
+    // removing the watch sends the thread an IN_IGNORED event to stop at
+    inotify_rm_watch(watch->fd, watch->wd);
+    SDL_WaitThread(watch->thread, NULL);
+    close(watch->fd);
+    SDL_free(watch);
+#else
+    (void)watch;
+#endif
+}
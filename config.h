@@ -0,0 +1,43 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+#include "osc.h"
+#include "synth.h"
+
+#define MAX_BINDINGS NOTES // keycode bindings a config file may have
+
+/* What a config file sets: the tuning, the wave form and volume to start
+ * with, and which keycode plays which key. Whatever the file leaves out
+ * keeps its default, see defaultConfig.
+ */
+typedef struct Config {
+    double a4;      // frequency of A4, the other keys follow from it
+    WaveForm wave;
+    Sint8 volume;   // 1 to 127
+    Binding bindings[MAX_BINDINGS];
+    int b_len;      // how many bindings there are
+} Config;
+
+/* Tells the main thread when the config file has changed, by pushing an
+ * SDL event of the given type from a thread of its own. The directory of
+ * the file is watched rather than the file itself, so that editors which
+ * save by writing a new file and renaming it over the old one are seen too.
+ */
+typedef struct ConfigWatch {
+    int fd;         // the inotify instance
+    int wd;         // its watch on the directory
+    char name[256]; // of the file in that directory
+    Uint32 event;   // SDL event type to push
+    SDL_Thread *thread;
+} ConfigWatch;
+
+void defaultConfig(Config *config);
+bool readConfig(const char *path, Keys *keys, Config *config);
+bool applyConfig(const Config *config, const Config *old, Keys *keys,
+        Engine *engine);
+ConfigWatch *watchConfig(const char *path, Uint32 event);
+void stopWatching(ConfigWatch *watch);
+
+#endif
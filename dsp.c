@@ -0,0 +1,192 @@
+#include "dsp.h"
+
+/* Scalar kernels, the fallback for CPUs without SSE2 and the reference
+ * output for the vector versions
+ */
+
+#define SCALAR_OSC(name, shape) \
+    static void name(float *out, float start, float inc, int len) { \
+        for (int i = 0; i < len; i++) { \
+            out[i] = shape(phaseAt(start, inc, i)); \
+        } \
+    }
+
+// the band-limited ones also need the increment, and its inverse
+#define SCALAR_BLEP(name, shape) \
+    static void name(float *out, float start, float inc, int len) { \
+        float idt = 1.0f / inc; \
+        for (int i = 0; i < len; i++) { \
+            out[i] = shape(phaseAt(start, inc, i), inc, idt); \
+        } \
+    }
+
+SCALAR_OSC(squareScalar, squareAt)
+SCALAR_OSC(triangleScalar, triangleAt)
+SCALAR_OSC(sawScalar, sawAt)
+SCALAR_OSC(sineScalar, sinTurn)
+SCALAR_OSC(opl21Scalar, opl21At)
+SCALAR_OSC(opl22Scalar, opl22At)
+SCALAR_OSC(opl23Scalar, opl23At)
+SCALAR_BLEP(squareBlepScalar, squareBlepAt)
+SCALAR_BLEP(triangleBlepScalar, triangleBlepAt)
+SCALAR_BLEP(sawBlepScalar, sawBlepAt)
+
+static void addScalar(float *mix, const float *voice, int len) {
+    for (int i = 0; i < len; i++) {
+        mix[i] += voice[i];
+    }
+}
+
+// adds voice with a gain that starts at from and changes by step per sample
+static void addRampScalar(float *mix, const float *voice, int len,
+        float from, float step) {
+    for (int i = 0; i < len; i++) {
+        mix[i] += voice[i] * (from + i * step);
+    }
+}
+
+static void gainScalar(float *mix, float gain, int len) {
+    for (int i = 0; i < len; i++) {
+        mix[i] *= gain;
+    }
+}
+
+static void gainRampScalar(float *mix, int len, float from, float step) {
+    for (int i = 0; i < len; i++) {
+        mix[i] *= from + i * step;
+    }
+}
+
+static void toS8Scalar(Sint8 *out, const float *mix, int len) {
+    for (int i = 0; i < len; i++) {
+        out[i] = sampleToS8(mix[i]);
+    }
+}
+
+static void toS16Scalar(Sint16 *out, const float *mix, int len) {
+    for (int i = 0; i < len; i++) {
+        out[i] = sampleToS16(mix[i]);
+    }
+}
+
+static void toS32Scalar(Sint32 *out, const float *mix, int len) {
+    for (int i = 0; i < len; i++) {
+        out[i] = sampleToS32(mix[i]);
+    }
+}
+
+static void toF32Scalar(float *out, const float *mix, int len) {
+    for (int i = 0; i < len; i++) {
+        out[i] = clampf(mix[i], -1.0f, 1.0f);
+    }
+}
+
+static void spreadScalar(float *out, const float *mix, int len, int channels) {
+    for (int i = 0; i < len; i++) {
+        for (int c = 0; c < channels; c++) {
+            out[i * channels + c] = mix[i];
+        }
+    }
+}
+
+static float peakScalar(const float *mix, int len) {
+    float peak = 0;
+    for (int i = 0; i < len; i++) {
+        float x = mix[i] < 0 ? -mix[i] : mix[i];
+        peak = x > peak ? x : peak;
+    }
+    return peak;
+}
+
+static float energyScalar(const float *mix, int len) {
+    float sums[SUM_LANES] = { 0 };
+    float energy = 0;
+    for (int i = 0; i < len; i++) {
+        sums[i % SUM_LANES] += mix[i] * mix[i];
+    }
+    for (int l = 0; l < SUM_LANES; l++) {
+        energy += sums[l];
+    }
+    return energy;
+}
+
+static void wavetableScalar(float *out, const float *table, float start,
+        float inc, int len) {
+    for (int i = 0; i < len; i++) {
+        out[i] = tableAt(table, phaseAt(start, inc, i));
+    }
+}
+
+static void noiseScalar(Uint32 *state, float *out, int len) {
+    for (int i = 0; i < len; i++) {
+        Uint32 *s = &state[i % NOISE_LANES];
+        *s = xorshift(*s);
+        out[i] = noiseAt(*s);
+    }
+}
+
+static void multiplyAddScalar(float *re, float *im, const float *a_re,
+        const float *a_im, const float *b_re, const float *b_im, int len) {
+    for (int i = 0; i < len; i++) {
+        re[i] += a_re[i] * b_re[i] - a_im[i] * b_im[i];
+        im[i] += a_re[i] * b_im[i] + a_im[i] * b_re[i];
+    }
+}
+
+const Kernels scalarKernels = {
+    "scalar",
+    { squareScalar, triangleScalar, sawScalar, NULL,
+      sineScalar, opl21Scalar, opl22Scalar, opl23Scalar },
+    { squareBlepScalar, triangleBlepScalar, sawBlepScalar },
+    addScalar,
+    addRampScalar,
+    gainScalar,
+    gainRampScalar,
+    toS8Scalar,
+    toS16Scalar,
+    toS32Scalar,
+    toF32Scalar,
+    spreadScalar,
+    peakScalar,
+    energyScalar,
+    wavetableScalar,
+    noiseScalar,
+    multiplyAddScalar
+};
+
+const Kernels *dsp = &scalarKernels;
+
+/* Picks the fastest kernels this CPU supports. SSE2 is part of x86-64, AVX2
+ * is checked for at runtime.
+ */
+void setupKernels() {
+    dsp = &scalarKernels;
+#if defined(__x86_64__) || defined(__i386__)
+    if (SDL_HasAVX2()) {
+        dsp = &avx2Kernels;
+    } else if (SDL_HasSSE2()) {
+        dsp = &sse2Kernels;
+    }
+#endif
+}
+
+/* Forces a particular set of kernels by name, eg for benchmarks. Returns
+ * false if this CPU or build cannot do them.
+ */
+bool selectKernels(const char *name) {
+    if (SDL_strcmp(name, scalarKernels.name) == 0) {
+        dsp = &scalarKernels;
+        return true;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    if (SDL_strcmp(name, sse2Kernels.name) == 0 && SDL_HasSSE2()) {
+        dsp = &sse2Kernels;
+        return true;
+    }
+    if (SDL_strcmp(name, avx2Kernels.name) == 0 && SDL_HasAVX2()) {
+        dsp = &avx2Kernels;
+        return true;
+    }
+#endif
+    return false;
+}
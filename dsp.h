@@ -0,0 +1,228 @@
+#ifndef DSP_H
+#define DSP_H
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+#include "osc.h"
+
+/* The inner loops of the synth, in a scalar, an SSE2 and an AVX2 version.
+ * setupKernels picks the best one the CPU can do, everything else calls
+ * through dsp. All versions do the same float operations in the same order,
+ * so their output is bit for bit identical (make bench checks this).
+ *
+ * Mix buffers are float with 1.0 as full scale.
+ */
+
+#define TABLE_LEN 2048  // samples in one period of a wave table, a power of 2
+#define SUM_LANES 8     // partial sums energy keeps, whatever the vector width
+
+typedef struct Kernels {
+    const char *name;
+    OscKernel osc[WAVE_FORMS]; // NULL for noise, see noise below
+    OscKernel blep[WAVE_FORMS]; // band-limited square, triangle and saw
+    void (*add)(float *mix, const float *voice, int len);
+    void (*addRamp)(float *mix, const float *voice, int len,
+            float from, float step);
+    void (*gain)(float *mix, float gain, int len);
+    // multiplies by a gain that starts at from and changes by step per sample
+    void (*gainRamp)(float *mix, int len, float from, float step);
+    void (*toS8)(Sint8 *out, const float *mix, int len);
+    void (*toS16)(Sint16 *out, const float *mix, int len);
+    void (*toS32)(Sint32 *out, const float *mix, int len);
+    void (*toF32)(float *out, const float *mix, int len);
+    // copies every sample of a mono mix to all channels of an interleaved one
+    void (*spread)(float *out, const float *mix, int len, int channels);
+    // largest absolute value, 0 for an empty buffer
+    float (*peak)(const float *mix, int len);
+    // sum of the squares, sample i added to partial sum i % SUM_LANES
+    float (*energy)(const float *mix, int len);
+    // like an OscKernel, but reading the wave from a table, see tableAt
+    void (*wavetable)(float *out, const float *table, float start, float inc,
+            int len);
+    // noise from NOISE_LANES interleaved generators, see Osc
+    void (*noise)(Uint32 *state, float *out, int len);
+    // adds the product of spectra a and b to re and im, bin by bin, with
+    // the real and imaginary parts in arrays of their own, see fft.h
+    void (*multiplyAdd)(float *re, float *im, const float *a_re,
+            const float *a_im, const float *b_re, const float *b_im,
+            int len);
+} Kernels;
+
+extern const Kernels *dsp;
+extern const Kernels scalarKernels;
+#if defined(__x86_64__) || defined(__i386__)
+extern const Kernels sse2Kernels;
+extern const Kernels avx2Kernels;
+#endif
+
+void setupKernels();
+bool selectKernels(const char *name);
+
+/* Per-sample versions of the kernels. These are the reference the vector
+ * code has to match, and are used for the tails of the vector loops.
+ */
+
+// phase of sample i, computed from the start of the buffer instead of summed
+// sample by sample, so that rounding cannot creep in
+static inline float phaseAt(float start, float inc, int i) {
+    float p = start + i * inc;
+    return p - (int)p;
+}
+
+// sin(2 * pi * p) for 0 <= p < 1 without calling into libm: the phase is
+// folded onto the first quarter period, where an odd polynomial (Taylor up
+// to x^11) is good to about 6e-8
+static inline float sinTurn(float p) {
+    float t = p - 0.5f;         // sin(2pi p) == -sin(2pi t)
+    float a = t < 0 ? -t : t;
+    if (a > 0.25f) {
+        a = 0.5f - a;           // sin(pi - x) == sin(x)
+    }
+    float a2 = a * a;
+    float s = a * (6.283185307e+00f + a2 * (-4.134170224e+01f +
+                a2 * (8.160524928e+01f + a2 * (-7.670585975e+01f +
+                a2 * (4.205869394e+01f + a2 * -1.509464258e+01f)))));
+    return t < 0 ? s : -s;
+}
+
+static inline float squareAt(float p) {
+    return p < 0.5f ? -1.0f : 1.0f;
+}
+
+// the 'quarter' really is 0.35 of a period, which gives this triangle its
+// particular sound
+static inline float triangleAt(float p) {
+    if (p <= 0.35f) {
+        return p / 0.35f;
+    } else if (p <= 0.5f) {
+        return 1 - (p - 0.35f) / 0.35f;
+    } else if (p <= 0.75f) {
+        return 0 - (p - 0.5f) / 0.35f;
+    }
+    return -1 + (p - 0.75f) / 0.35f; // the last quarter of the 'wave'
+}
+
+static inline float sawAt(float p) {
+    return -1.0f + p * 2;
+}
+
+static inline float opl21At(float p) {
+    return p <= 0.5f ? sinTurn(p) : 0;
+}
+
+static inline float opl22At(float p) {
+    float s = sinTurn(p);
+    return p <= 0.5f ? s : -s;
+}
+
+static inline float opl23At(float p) {
+    float s = sinTurn(p);
+    if (p <= 0.35f) {
+        return s;
+    } else if (p <= 0.5f) {
+        return 0;
+    } else if (p <= 0.75f) {
+        return -s;
+    }
+    return 0; // the last quarter of the 'wave'
+}
+
+/* PolyBLEP: what has to be added to a naive unit step to band-limit it, for
+ * a sample t past the step (as a phase, wrapping at 1) with a phase
+ * increment of dt per sample. Only the sample on either side of the step
+ * gets anything, so this is far cheaper than oversampling.
+ */
+static inline float stepResidual(float t, float dt, float idt) {
+    if (t < dt) {
+        float x = 1 - t * idt;
+        return x * x * -0.5f;
+    } else if (t > 1 - dt) {
+        float x = (t - 1) * idt + 1;
+        return x * x * 0.5f;
+    }
+    return 0;
+}
+
+// the same for a kink, a unit change of slope per period (PolyBLAMP)
+static inline float rampResidual(float t, float dt, float idt) {
+    if (t < dt) {
+        float x = 1 - t * idt;
+        return x * x * x * dt * (1.0f / 6);
+    } else if (t > 1 - dt) {
+        float x = (t - 1) * idt + 1;
+        return x * x * x * dt * (1.0f / 6);
+    }
+    return 0;
+}
+
+// phase relative to a discontinuity at d
+static inline float phaseFrom(float p, float d) {
+    float t = p - d;
+    return t < 0 ? t + 1 : t;
+}
+
+// the band-limited shapes: the naive one plus a residual for every jump,
+// scaled by its height, and for every kink, scaled by the change in slope
+static inline float squareBlepAt(float p, float dt, float idt) {
+    float y = squareAt(p);
+    y += 2 * stepResidual(phaseFrom(p, 0.5f), dt, idt);
+    y += -2 * stepResidual(p, dt, idt);
+    return y;
+}
+
+static inline float triangleBlepAt(float p, float dt, float idt) {
+    float y = triangleAt(p);
+    y += (-4.0f / 7) * stepResidual(phaseFrom(p, 0.5f), dt, idt);
+    y += (-2.0f / 7) * stepResidual(phaseFrom(p, 0.75f), dt, idt);
+    y += (2.0f / 7) * stepResidual(p, dt, idt);
+    y += (-2 / 0.35f) * rampResidual(phaseFrom(p, 0.35f), dt, idt);
+    y += (2 / 0.35f) * rampResidual(phaseFrom(p, 0.75f), dt, idt);
+    return y;
+}
+
+static inline float sawBlepAt(float p, float dt, float idt) {
+    return sawAt(p) + -2 * stepResidual(p, dt, idt);
+}
+
+// one period of a wave, TABLE_LEN samples plus a copy of the first one at
+// the end, read at phase p by linear interpolation
+static inline float tableAt(const float *table, float p) {
+    float pos = p * TABLE_LEN;
+    int i = (int)pos;
+    float frac = pos - i;
+    return table[i] + frac * (table[i + 1] - table[i]);
+}
+
+// one step of a xorshift generator
+static inline Uint32 xorshift(Uint32 x) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+// a generator state made into a whole number from -10 to 9, the range the
+// noise has always had
+static inline float noiseAt(Uint32 x) {
+    return (int)((x >> 8) * (20.0f / 16777216)) - 10.0f;
+}
+
+static inline float clampf(float x, float lo, float hi) {
+    return x < lo ? lo : (x > hi ? hi : x);
+}
+
+static inline Sint8 sampleToS8(float x) {
+    return (Sint8)clampf(x * 128.0f, -128.0f, 127.0f);
+}
+
+static inline Sint16 sampleToS16(float x) {
+    return (Sint16)clampf(x * 32768.0f, -32768.0f, 32767.0f);
+}
+
+// 2147483520 is the largest float below 2^31, a float only has 24 bits of
+// precision anyway
+static inline Sint32 sampleToS32(float x) {
+    return (Sint32)clampf(x * 2147483648.0f, -2147483648.0f, 2147483520.0f);
+}
+
+#endif
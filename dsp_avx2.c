@@ -0,0 +1,107 @@
+#include "dsp.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/* AVX2 kernels, 8 samples at a time. Only built for AVX2 here, not for the
+ * whole program, setupKernels checks at runtime if the CPU can run them.
+ */
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+typedef __m256 vf;
+#define VI __m256i
+#define W 8
+#define VRAMP _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7)
+#define VSET1(x) _mm256_set1_ps(x)
+#define VLOAD(p) _mm256_loadu_ps(p)
+#define VSTORE(p, v) _mm256_storeu_ps(p, v)
+#define VADD(a, b) _mm256_add_ps(a, b)
+#define VSUB(a, b) _mm256_sub_ps(a, b)
+#define VMUL(a, b) _mm256_mul_ps(a, b)
+#define VDIV(a, b) _mm256_div_ps(a, b)
+#define VMIN(a, b) _mm256_min_ps(a, b)
+#define VMAX(a, b) _mm256_max_ps(a, b)
+#define VAND(a, b) _mm256_and_ps(a, b)
+#define VOR(a, b) _mm256_or_ps(a, b)
+#define VXOR(a, b) _mm256_xor_ps(a, b)
+#define VANDNOT(a, b) _mm256_andnot_ps(a, b)
+#define VCMPLT(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define VCMPLE(a, b) _mm256_cmp_ps(a, b, _CMP_LE_OQ)
+#define VCMPGT(a, b) _mm256_cmp_ps(a, b, _CMP_GT_OQ)
+#define VBLEND(a, b, m) _mm256_blendv_ps(a, b, m)
+#define VCVTT(x) _mm256_cvttps_epi32(x)
+#define VTRUNC(x) _mm256_cvtepi32_ps(_mm256_cvttps_epi32(x))
+#define VSTOREI(p, v) _mm256_storeu_si256(p, v)
+#define VTOF(x) _mm256_cvtepi32_ps(x)
+#define VLOADI(p) _mm256_loadu_si256(p)
+#define VXORI(a, b) _mm256_xor_si256(a, b)
+#define VSLLI(x, n) _mm256_slli_epi32(x, n)
+#define VSRLI(x, n) _mm256_srli_epi32(x, n)
+#define VGATHER(table, index) _mm256_i32gather_ps(table, index, 4)
+// unpack works per 128 bit lane, so the halves need putting back in order
+#define VDUPLO(x) _mm256_permute2f128_ps(_mm256_unpacklo_ps(x, x), \
+        _mm256_unpackhi_ps(x, x), 0x20)
+#define VDUPHI(x) _mm256_permute2f128_ps(_mm256_unpacklo_ps(x, x), \
+        _mm256_unpackhi_ps(x, x), 0x31)
+
+#include "dsp_simd.h"
+
+// the pack instructions work per 128 bit lane, the permutes put the samples
+// back in order afterwards
+static void toS8Kernel(Sint8 *out, const float *mix, int len) {
+    const VI order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    int i = 0;
+    for (; i + 32 <= len; i += 32) {
+        VI a = vtoInt(VLOAD(mix + i), 128.0f, -128.0f, 127.0f);
+        VI b = vtoInt(VLOAD(mix + i + 8), 128.0f, -128.0f, 127.0f);
+        VI c = vtoInt(VLOAD(mix + i + 16), 128.0f, -128.0f, 127.0f);
+        VI d = vtoInt(VLOAD(mix + i + 24), 128.0f, -128.0f, 127.0f);
+        VI ab = _mm256_packs_epi32(a, b);
+        VI cd = _mm256_packs_epi32(c, d);
+        VI packed = _mm256_packs_epi16(ab, cd);
+        VI abcd = _mm256_permutevar8x32_epi32(packed, order);
+        _mm256_storeu_si256((VI*)(out + i), abcd);
+    }
+    for (; i < len; i++) {
+        out[i] = sampleToS8(mix[i]);
+    }
+}
+
+static void toS16Kernel(Sint16 *out, const float *mix, int len) {
+    int i = 0;
+    for (; i + 16 <= len; i += 16) {
+        VI a = vtoInt(VLOAD(mix + i), 32768.0f, -32768.0f, 32767.0f);
+        VI b = vtoInt(VLOAD(mix + i + 8), 32768.0f, -32768.0f, 32767.0f);
+        VI ab = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b),
+                _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256((VI*)(out + i), ab);
+    }
+    for (; i < len; i++) {
+        out[i] = sampleToS16(mix[i]);
+    }
+}
+
+const Kernels avx2Kernels = {
+    "avx2",
+    { squareKernel, triangleKernel, sawKernel, NULL,
+      sineKernel, opl21Kernel, opl22Kernel, opl23Kernel },
+    { squareBlepKernel, triangleBlepKernel, sawBlepKernel },
+    addKernel,
+    addRampKernel,
+    gainKernel,
+    gainRampKernel,
+    toS8Kernel,
+    toS16Kernel,
+    toS32Kernel,
+    toF32Kernel,
+    spreadKernel,
+    peakKernel,
+    energyKernel,
+    wavetableKernel,
+    noiseKernel,
+    multiplyAddKernel
+};
+
+#else
+typedef int dsp_avx2_unused; // nothing to build on this CPU
+#endif
@@ -0,0 +1,378 @@
+/* Vector kernels written once for any vector width. Not a normal header:
+ * dsp_sse2.c and dsp_avx2.c each define the vf type and the V* macros for
+ * their instruction set and then include this file.
+ *
+ * Every kernel here has to do exactly what its scalar counterpart in dsp.h
+ * does, operation for operation, so that all paths stay bit identical.
+ */
+
+#define WAVE_KERNEL(name, shape, scalar) \
+    static void name(float *out, float start, float inc, int len) { \
+        vf vstart = VSET1(start); \
+        vf vinc = VSET1(inc); \
+        int i = 0; \
+        for (; i + W <= len; i += W) { \
+            VSTORE(out + i, shape(vphaseAt(vstart, vinc, i))); \
+        } \
+        for (; i < len; i++) { \
+            out[i] = scalar(phaseAt(start, inc, i)); \
+        } \
+    }
+
+#define BLEP_KERNEL(name, shape, scalar) \
+    static void name(float *out, float start, float inc, int len) { \
+        float idt = 1.0f / inc; \
+        vf vstart = VSET1(start); \
+        vf vinc = VSET1(inc); \
+        vf vidt = VSET1(idt); \
+        int i = 0; \
+        for (; i + W <= len; i += W) { \
+            VSTORE(out + i, shape(vphaseAt(vstart, vinc, i), vinc, vidt)); \
+        } \
+        for (; i < len; i++) { \
+            out[i] = scalar(phaseAt(start, inc, i), inc, idt); \
+        } \
+    }
+
+static inline vf vphaseAt(vf start, vf inc, int i) {
+    vf index = VADD(VSET1((float)i), VRAMP);
+    vf p = VADD(start, VMUL(index, inc));
+    return VSUB(p, VTRUNC(p));
+}
+
+static inline vf vneg(vf x) {
+    return VXOR(x, VSET1(-0.0f));
+}
+
+static inline vf vsinTurn(vf p) {
+    vf t = VSUB(p, VSET1(0.5f));
+    vf a = VANDNOT(VSET1(-0.0f), t);
+    a = VBLEND(a, VSUB(VSET1(0.5f), a), VCMPGT(a, VSET1(0.25f)));
+    vf a2 = VMUL(a, a);
+    vf s = VMUL(a2, VSET1(-1.509464258e+01f));
+    s = VMUL(a2, VADD(VSET1(4.205869394e+01f), s));
+    s = VMUL(a2, VADD(VSET1(-7.670585975e+01f), s));
+    s = VMUL(a2, VADD(VSET1(8.160524928e+01f), s));
+    s = VMUL(a2, VADD(VSET1(-4.134170224e+01f), s));
+    s = VMUL(a, VADD(VSET1(6.283185307e+00f), s));
+    return VBLEND(vneg(s), s, VCMPLT(t, VSET1(0.0f)));
+}
+
+static inline vf vsquareAt(vf p) {
+    return VBLEND(VSET1(1.0f), VSET1(-1.0f), VCMPLT(p, VSET1(0.5f)));
+}
+
+// each quarter is base +/- (p - corner) / 0.35, so pick the corner, base and
+// sign per lane first and get away with a single division
+static inline vf vtriangleAt(vf p) {
+    vf m1 = VCMPLE(p, VSET1(0.35f));
+    vf m2 = VCMPLE(p, VSET1(0.5f));
+    vf m3 = VCMPLE(p, VSET1(0.75f));
+    vf corner = VBLEND(VBLEND(VBLEND(VSET1(0.75f), VSET1(0.5f), m3),
+                VSET1(0.35f), m2), VSET1(0.0f), m1);
+    vf base = VBLEND(VBLEND(VBLEND(VSET1(-1.0f), VSET1(0.0f), m3),
+                VSET1(1.0f), m2), VSET1(0.0f), m1);
+    vf flip = VANDNOT(m1, VAND(m2, VSET1(-0.0f)));
+    flip = VOR(flip, VANDNOT(m2, VAND(m3, VSET1(-0.0f))));
+    vf d = VDIV(VSUB(p, corner), VSET1(0.35f));
+    return VADD(base, VXOR(d, flip));
+}
+
+static inline vf vsawAt(vf p) {
+    return VADD(VSET1(-1.0f), VMUL(p, VSET1(2.0f)));
+}
+
+static inline vf vopl21At(vf p) {
+    return VBLEND(VSET1(0.0f), vsinTurn(p), VCMPLE(p, VSET1(0.5f)));
+}
+
+static inline vf vopl22At(vf p) {
+    vf s = vsinTurn(p);
+    return VBLEND(vneg(s), s, VCMPLE(p, VSET1(0.5f)));
+}
+
+static inline vf vopl23At(vf p) {
+    vf s = vsinTurn(p);
+    vf r = VBLEND(VSET1(0.0f), vneg(s), VCMPLE(p, VSET1(0.75f)));
+    r = VBLEND(r, VSET1(0.0f), VCMPLE(p, VSET1(0.5f)));
+    return VBLEND(r, s, VCMPLE(p, VSET1(0.35f)));
+}
+
+// both residuals are worked out for every lane and the right one picked
+static inline vf vstepResidual(vf t, vf dt, vf idt) {
+    vf one = VSET1(1.0f);
+    vf x = VSUB(one, VMUL(t, idt));
+    vf after = VMUL(VMUL(x, x), VSET1(-0.5f));
+    x = VADD(VMUL(VSUB(t, one), idt), one);
+    vf before = VMUL(VMUL(x, x), VSET1(0.5f));
+    vf r = VBLEND(VSET1(0.0f), before, VCMPGT(t, VSUB(one, dt)));
+    return VBLEND(r, after, VCMPLT(t, dt));
+}
+
+static inline vf vrampResidual(vf t, vf dt, vf idt) {
+    vf one = VSET1(1.0f);
+    vf sixth = VSET1(1.0f / 6);
+    vf x = VSUB(one, VMUL(t, idt));
+    vf after = VMUL(VMUL(VMUL(VMUL(x, x), x), dt), sixth);
+    x = VADD(VMUL(VSUB(t, one), idt), one);
+    vf before = VMUL(VMUL(VMUL(VMUL(x, x), x), dt), sixth);
+    vf r = VBLEND(VSET1(0.0f), before, VCMPGT(t, VSUB(one, dt)));
+    return VBLEND(r, after, VCMPLT(t, dt));
+}
+
+static inline vf vphaseFrom(vf p, float d) {
+    vf t = VSUB(p, VSET1(d));
+    return VBLEND(t, VADD(t, VSET1(1.0f)), VCMPLT(t, VSET1(0.0f)));
+}
+
+static inline vf vsquareBlepAt(vf p, vf dt, vf idt) {
+    vf y = vsquareAt(p);
+    y = VADD(y, VMUL(VSET1(2.0f), vstepResidual(vphaseFrom(p, 0.5f), dt, idt)));
+    y = VADD(y, VMUL(VSET1(-2.0f), vstepResidual(p, dt, idt)));
+    return y;
+}
+
+static inline vf vtriangleBlepAt(vf p, vf dt, vf idt) {
+    vf y = vtriangleAt(p);
+    y = VADD(y, VMUL(VSET1(-4.0f / 7),
+                vstepResidual(vphaseFrom(p, 0.5f), dt, idt)));
+    y = VADD(y, VMUL(VSET1(-2.0f / 7),
+                vstepResidual(vphaseFrom(p, 0.75f), dt, idt)));
+    y = VADD(y, VMUL(VSET1(2.0f / 7), vstepResidual(p, dt, idt)));
+    y = VADD(y, VMUL(VSET1(-2 / 0.35f),
+                vrampResidual(vphaseFrom(p, 0.35f), dt, idt)));
+    y = VADD(y, VMUL(VSET1(2 / 0.35f),
+                vrampResidual(vphaseFrom(p, 0.75f), dt, idt)));
+    return y;
+}
+
+static inline vf vsawBlepAt(vf p, vf dt, vf idt) {
+    return VADD(vsawAt(p), VMUL(VSET1(-2.0f), vstepResidual(p, dt, idt)));
+}
+
+WAVE_KERNEL(squareKernel, vsquareAt, squareAt)
+WAVE_KERNEL(triangleKernel, vtriangleAt, triangleAt)
+WAVE_KERNEL(sawKernel, vsawAt, sawAt)
+WAVE_KERNEL(sineKernel, vsinTurn, sinTurn)
+WAVE_KERNEL(opl21Kernel, vopl21At, opl21At)
+WAVE_KERNEL(opl22Kernel, vopl22At, opl22At)
+WAVE_KERNEL(opl23Kernel, vopl23At, opl23At)
+BLEP_KERNEL(squareBlepKernel, vsquareBlepAt, squareBlepAt)
+BLEP_KERNEL(triangleBlepKernel, vtriangleBlepAt, triangleBlepAt)
+BLEP_KERNEL(sawBlepKernel, vsawBlepAt, sawBlepAt)
+
+static void addKernel(float *mix, const float *voice, int len) {
+    int i = 0;
+    for (; i + W <= len; i += W) {
+        VSTORE(mix + i, VADD(VLOAD(mix + i), VLOAD(voice + i)));
+    }
+    for (; i < len; i++) {
+        mix[i] += voice[i];
+    }
+}
+
+static void addRampKernel(float *mix, const float *voice, int len,
+        float from, float step) {
+    vf vfrom = VSET1(from);
+    vf vstep = VSET1(step);
+    int i = 0;
+    for (; i + W <= len; i += W) {
+        vf index = VADD(VSET1((float)i), VRAMP);
+        vf gain = VADD(vfrom, VMUL(index, vstep));
+        VSTORE(mix + i, VADD(VLOAD(mix + i), VMUL(VLOAD(voice + i), gain)));
+    }
+    for (; i < len; i++) {
+        mix[i] += voice[i] * (from + i * step);
+    }
+}
+
+static void gainKernel(float *mix, float gain, int len) {
+    vf vgain = VSET1(gain);
+    int i = 0;
+    for (; i + W <= len; i += W) {
+        VSTORE(mix + i, VMUL(VLOAD(mix + i), vgain));
+    }
+    for (; i < len; i++) {
+        mix[i] *= gain;
+    }
+}
+
+static void gainRampKernel(float *mix, int len, float from, float step) {
+    vf vfrom = VSET1(from);
+    vf vstep = VSET1(step);
+    int i = 0;
+    for (; i + W <= len; i += W) {
+        vf index = VADD(VSET1((float)i), VRAMP);
+        VSTORE(mix + i, VMUL(VLOAD(mix + i), VADD(vfrom, VMUL(index, vstep))));
+    }
+    for (; i < len; i++) {
+        mix[i] *= from + i * step;
+    }
+}
+
+static void toF32Kernel(float *out, const float *mix, int len) {
+    vf lo = VSET1(-1.0f);
+    vf hi = VSET1(1.0f);
+    int i = 0;
+    for (; i + W <= len; i += W) {
+        VSTORE(out + i, VMIN(VMAX(VLOAD(mix + i), lo), hi));
+    }
+    for (; i < len; i++) {
+        out[i] = clampf(mix[i], -1.0f, 1.0f);
+    }
+}
+
+// scaled, clamped and truncated to int32 lanes, ready to be packed down
+// or stored as is
+static inline VI vtoInt(vf x, float scale, float lo, float hi) {
+    x = VMUL(x, VSET1(scale));
+    return VCVTT(VMIN(VMAX(x, VSET1(lo)), VSET1(hi)));
+}
+
+static void toS32Kernel(Sint32 *out, const float *mix, int len) {
+    int i = 0;
+    for (; i + W <= len; i += W) {
+        VI x = vtoInt(VLOAD(mix + i), 2147483648.0f, -2147483648.0f,
+                2147483520.0f);
+        VSTOREI((VI*)(out + i), x);
+    }
+    for (; i < len; i++) {
+        out[i] = sampleToS32(mix[i]);
+    }
+}
+
+// stereo is the one that matters, anything else goes sample by sample
+static void spreadKernel(float *out, const float *mix, int len, int channels) {
+    int i = 0;
+    if (channels == 2) {
+        for (; i + W <= len; i += W) {
+            vf x = VLOAD(mix + i);
+            VSTORE(out + 2 * i, VDUPLO(x));
+            VSTORE(out + 2 * i + W, VDUPHI(x));
+        }
+    }
+    for (; i < len; i++) {
+        for (int c = 0; c < channels; c++) {
+            out[i * channels + c] = mix[i];
+        }
+    }
+}
+
+static float peakKernel(const float *mix, int len) {
+    vf sign = VSET1(-0.0f);
+    vf acc = VSET1(0.0f);
+    float lanes[W];
+    float peak = 0;
+    int i = 0;
+    for (; i + W <= len; i += W) {
+        acc = VMAX(acc, VANDNOT(sign, VLOAD(mix + i)));
+    }
+    VSTORE(lanes, acc);
+    for (int l = 0; l < W; l++) {
+        peak = lanes[l] > peak ? lanes[l] : peak;
+    }
+    for (; i < len; i++) {
+        float x = mix[i] < 0 ? -mix[i] : mix[i];
+        peak = x > peak ? x : peak;
+    }
+    return peak;
+}
+
+// SUM_LANES partial sums, the same ones energyScalar keeps, so the total
+// comes out the same
+static float energyKernel(const float *mix, int len) {
+    vf acc[SUM_LANES / W];
+    float sums[SUM_LANES];
+    float energy = 0;
+    int i = 0;
+    for (int l = 0; l < SUM_LANES / W; l++) {
+        acc[l] = VSET1(0.0f);
+    }
+    for (; i + SUM_LANES <= len; i += SUM_LANES) {
+        for (int l = 0; l < SUM_LANES / W; l++) {
+            vf x = VLOAD(mix + i + l * W);
+            acc[l] = VADD(acc[l], VMUL(x, x));
+        }
+    }
+    for (int l = 0; l < SUM_LANES / W; l++) {
+        VSTORE(sums + l * W, acc[l]);
+    }
+    for (; i < len; i++) {
+        sums[i % SUM_LANES] += mix[i] * mix[i];
+    }
+    for (int l = 0; l < SUM_LANES; l++) {
+        energy += sums[l];
+    }
+    return energy;
+}
+
+// the table lookups are the only part that cannot be done as a vector
+// before AVX2, see VGATHER
+static void wavetableKernel(float *out, const float *table, float start,
+        float inc, int len) {
+    vf vstart = VSET1(start);
+    vf vinc = VSET1(inc);
+    int i = 0;
+    for (; i + W <= len; i += W) {
+        vf pos = VMUL(vphaseAt(vstart, vinc, i), VSET1((float)TABLE_LEN));
+        VI index = VCVTT(pos);
+        vf frac = VSUB(pos, VTOF(index));
+        vf a = VGATHER(table, index);
+        vf b = VGATHER(table + 1, index);
+        VSTORE(out + i, VADD(a, VMUL(frac, VSUB(b, a))));
+    }
+    for (; i < len; i++) {
+        out[i] = tableAt(table, phaseAt(start, inc, i));
+    }
+}
+
+static inline VI vxorshift(VI x) {
+    x = VXORI(x, VSLLI(x, 13));
+    x = VXORI(x, VSRLI(x, 17));
+    return VXORI(x, VSLLI(x, 5));
+}
+
+static inline vf vnoiseAt(VI x) {
+    vf scaled = VMUL(VTOF(VSRLI(x, 8)), VSET1(20.0f / 16777216));
+    return VSUB(VTOF(VCVTT(scaled)), VSET1(10.0f));
+}
+
+// NOISE_LANES samples per round, whatever the vector width
+static void noiseKernel(Uint32 *state, float *out, int len) {
+    VI s[NOISE_LANES / W];
+    int i = 0;
+    for (int l = 0; l < NOISE_LANES / W; l++) {
+        s[l] = VLOADI((const VI*)(state + l * W));
+    }
+    for (; i + NOISE_LANES <= len; i += NOISE_LANES) {
+        for (int l = 0; l < NOISE_LANES / W; l++) {
+            s[l] = vxorshift(s[l]);
+            VSTORE(out + i + l * W, vnoiseAt(s[l]));
+        }
+    }
+    for (int l = 0; l < NOISE_LANES / W; l++) {
+        VSTOREI((VI*)(state + l * W), s[l]);
+    }
+    for (; i < len; i++) {
+        Uint32 *st = &state[i % NOISE_LANES];
+        *st = xorshift(*st);
+        out[i] = noiseAt(*st);
+    }
+}
+
+static void multiplyAddKernel(float *re, float *im, const float *a_re,
+        const float *a_im, const float *b_re, const float *b_im, int len) {
+    int i = 0;
+    for (; i + W <= len; i += W) {
+        vf ar = VLOAD(a_re + i);
+        vf ai = VLOAD(a_im + i);
+        vf br = VLOAD(b_re + i);
+        vf bi = VLOAD(b_im + i);
+        VSTORE(re + i, VADD(VLOAD(re + i), VSUB(VMUL(ar, br), VMUL(ai, bi))));
+        VSTORE(im + i, VADD(VLOAD(im + i), VADD(VMUL(ar, bi), VMUL(ai, br))));
+    }
+    for (; i < len; i++) {
+        re[i] += a_re[i] * b_re[i] - a_im[i] * b_im[i];
+        im[i] += a_re[i] * b_im[i] + a_im[i] * b_re[i];
+    }
+}
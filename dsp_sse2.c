@@ -0,0 +1,104 @@
+#include "dsp.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/* SSE2 kernels, 4 samples at a time. SSE2 is part of x86-64, so these are
+ * the baseline on any 64 bit PC.
+ */
+#pragma GCC target("sse2")
+#include <emmintrin.h>
+
+typedef __m128 vf;
+#define VI __m128i
+#define W 4
+#define VRAMP _mm_setr_ps(0, 1, 2, 3)
+#define VSET1(x) _mm_set1_ps(x)
+#define VLOAD(p) _mm_loadu_ps(p)
+#define VSTORE(p, v) _mm_storeu_ps(p, v)
+#define VADD(a, b) _mm_add_ps(a, b)
+#define VSUB(a, b) _mm_sub_ps(a, b)
+#define VMUL(a, b) _mm_mul_ps(a, b)
+#define VDIV(a, b) _mm_div_ps(a, b)
+#define VMIN(a, b) _mm_min_ps(a, b)
+#define VMAX(a, b) _mm_max_ps(a, b)
+#define VAND(a, b) _mm_and_ps(a, b)
+#define VOR(a, b) _mm_or_ps(a, b)
+#define VXOR(a, b) _mm_xor_ps(a, b)
+#define VANDNOT(a, b) _mm_andnot_ps(a, b)
+#define VCMPLT(a, b) _mm_cmplt_ps(a, b)
+#define VCMPLE(a, b) _mm_cmple_ps(a, b)
+#define VCMPGT(a, b) _mm_cmpgt_ps(a, b)
+#define VBLEND(a, b, m) _mm_or_ps(_mm_and_ps(m, b), _mm_andnot_ps(m, a))
+#define VCVTT(x) _mm_cvttps_epi32(x)
+#define VTRUNC(x) _mm_cvtepi32_ps(_mm_cvttps_epi32(x))
+#define VSTOREI(p, v) _mm_storeu_si128(p, v)
+#define VDUPLO(x) _mm_unpacklo_ps(x, x)
+#define VDUPHI(x) _mm_unpackhi_ps(x, x)
+#define VTOF(x) _mm_cvtepi32_ps(x)
+#define VLOADI(p) _mm_loadu_si128(p)
+#define VXORI(a, b) _mm_xor_si128(a, b)
+#define VSLLI(x, n) _mm_slli_epi32(x, n)
+#define VSRLI(x, n) _mm_srli_epi32(x, n)
+#define VGATHER(table, index) gather(table, index)
+
+// no gather instruction in SSE2, the lanes are loaded one by one
+static inline __m128 gather(const float *table, __m128i index) {
+    int i[4];
+    _mm_storeu_si128((__m128i*)i, index);
+    return _mm_setr_ps(table[i[0]], table[i[1]], table[i[2]], table[i[3]]);
+}
+
+#include "dsp_simd.h"
+
+static void toS8Kernel(Sint8 *out, const float *mix, int len) {
+    int i = 0;
+    for (; i + 16 <= len; i += 16) {
+        VI a = vtoInt(VLOAD(mix + i), 128.0f, -128.0f, 127.0f);
+        VI b = vtoInt(VLOAD(mix + i + 4), 128.0f, -128.0f, 127.0f);
+        VI c = vtoInt(VLOAD(mix + i + 8), 128.0f, -128.0f, 127.0f);
+        VI d = vtoInt(VLOAD(mix + i + 12), 128.0f, -128.0f, 127.0f);
+        VI ab = _mm_packs_epi32(a, b);
+        VI cd = _mm_packs_epi32(c, d);
+        _mm_storeu_si128((VI*)(out + i), _mm_packs_epi16(ab, cd));
+    }
+    for (; i < len; i++) {
+        out[i] = sampleToS8(mix[i]);
+    }
+}
+
+static void toS16Kernel(Sint16 *out, const float *mix, int len) {
+    int i = 0;
+    for (; i + 8 <= len; i += 8) {
+        VI a = vtoInt(VLOAD(mix + i), 32768.0f, -32768.0f, 32767.0f);
+        VI b = vtoInt(VLOAD(mix + i + 4), 32768.0f, -32768.0f, 32767.0f);
+        _mm_storeu_si128((VI*)(out + i), _mm_packs_epi32(a, b));
+    }
+    for (; i < len; i++) {
+        out[i] = sampleToS16(mix[i]);
+    }
+}
+
+const Kernels sse2Kernels = {
+    "sse2",
+    { squareKernel, triangleKernel, sawKernel, NULL,
+      sineKernel, opl21Kernel, opl22Kernel, opl23Kernel },
+    { squareBlepKernel, triangleBlepKernel, sawBlepKernel },
+    addKernel,
+    addRampKernel,
+    gainKernel,
+    gainRampKernel,
+    toS8Kernel,
+    toS16Kernel,
+    toS32Kernel,
+    toF32Kernel,
+    spreadKernel,
+    peakKernel,
+    energyKernel,
+    wavetableKernel,
+    noiseKernel,
+    multiplyAddKernel
+};
+
+#else
+typedef int dsp_sse2_unused; // nothing to build on this CPU
+#endif
@@ -0,0 +1,75 @@
+#include "effects.h"
+
+void setupEffects(EffectBus *bus) {
+    bus->count = 0;
+    bus->tail = 0;
+    bus->quiet = 0;
+    SDL_AtomicSet(&bus->bypass, 0);
+    bus->on = false;
+}
+
+/* Puts fx at the end of the chain, which then owns it. Main thread, before
+ * the audio device starts. Returns false if the chain is full, then fx is
+ * freed.
+ */
+bool addEffect(EffectBus *bus, Effect *fx) {
+    if (bus->count == MAX_EFFECTS) {
+        SDL_SetError("no more than %d effects", MAX_EFFECTS);
+        fx->destroy(fx);
+        return false;
+    }
+    bus->effects[bus->count++] = fx;
+    bus->tail += fx->tail;
+    bus->quiet = bus->tail;
+    return true;
+}
+
+/* Takes the effects out of the signal path, or puts them back, from the
+ * next buffer on. Any thread.
+ */
+void bypassEffects(EffectBus *bus, bool bypass) {
+    SDL_AtomicSet(&bus->bypass, bypass);
+}
+
+/* Decides whether the effects run in this buffer. Render thread, at the
+ * start of every buffer.
+ */
+void takeBypass(EffectBus *bus) {
+    bool on = bus->count > 0 && !SDL_AtomicGet(&bus->bypass);
+    if (on && !bus->on) {
+        // what they had when they were bypassed is long gone
+        for (int i = 0; i < bus->count; i++) {
+            bus->effects[i]->clear(bus->effects[i]);
+        }
+        bus->quiet = bus->tail;
+    }
+    bus->on = on;
+}
+
+/* Runs len samples of the mix through every effect, sounding says if any
+ * voice went into them. Returns false when the effects have been silent
+ * for longer than their tails, then the mix is left as it is. Render
+ * thread only.
+ */
+bool runEffects(EffectBus *bus, float *audio, int len, bool sounding) {
+    if (sounding) {
+        bus->quiet = 0;
+    } else if (bus->quiet >= bus->tail) {
+        return false;
+    } else {
+        bus->quiet += len;
+    }
+    for (int i = 0; i < bus->count; i++) {
+        bus->effects[i]->process(bus->effects[i], audio, len);
+    }
+    return true;
+}
+
+void freeEffects(EffectBus *bus) {
+    for (int i = 0; i < bus->count; i++) {
+        bus->effects[i]->destroy(bus->effects[i]);
+    }
+    bus->count = 0;
+    bus->tail = 0;
+    bus->on = false;
+}
@@ -0,0 +1,48 @@
+#ifndef EFFECTS_H
+#define EFFECTS_H
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+
+#define MAX_EFFECTS 4
+
+typedef struct Effect Effect;
+
+/* A node of the effects bus. It works on the mono mix in place, in pieces
+ * of any length up to a buffer, and everything it keeps is allocated when
+ * it is made. A particular effect has this as its first member, so that a
+ * pointer to one is a pointer to the other.
+ */
+struct Effect {
+    const char *name;
+    void (*process)(Effect *fx, float *audio, int len);
+    void (*clear)(Effect *fx);      // forgets all input so far
+    void (*destroy)(Effect *fx);    // frees the effect and all it has
+    int tail;   // samples it can go on sounding for after its input stops
+};
+
+/* The effects the mix goes through, in order, before the master volume and
+ * the limiter. Effects are added before the audio device starts. Bypassed,
+ * the bus costs one test per piece of a buffer and the effects are not
+ * touched; when it comes back on they start from silence.
+ *
+ * While no voice sounds the effects are only run until their tails have
+ * died away, after that the mix is left silent, as it is without effects.
+ */
+typedef struct EffectBus {
+    Effect *effects[MAX_EFFECTS];
+    int count;
+    int tail;       // of all effects together
+    int quiet;      // samples since the input last had voices in it
+    SDL_atomic_t bypass; // set from any thread, see takeBypass
+    bool on;        // the effects run in this buffer, render thread only
+} EffectBus;
+
+void setupEffects(EffectBus *bus);
+bool addEffect(EffectBus *bus, Effect *fx);
+void bypassEffects(EffectBus *bus, bool bypass);
+void takeBypass(EffectBus *bus);
+bool runEffects(EffectBus *bus, float *audio, int len, bool sounding);
+void freeEffects(EffectBus *bus);
+
+#endif
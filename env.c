@@ -0,0 +1,65 @@
+#include "env.h"
+
+/* Sets up a line from the current level to target taking samples samples
+ */
+static void ramp(EnvState *env, EnvStage stage, float target, float samples) {
+    env->stage = stage;
+    env->target = target;
+    env->left = samples < 1 ? 1 : (int)samples;
+    env->step = (target - env->level) / env->left;
+}
+
+/* Moves on from a stage that has run its course
+ */
+static void nextStage(EnvState *env, const Envelope *shape, int rate) {
+    env->level = env->target;
+    if (env->stage == env_attack) {
+        ramp(env, env_decay, shape->sustain, shape->decay * rate);
+    } else if (env->stage == env_decay && shape->sustain > 0) {
+        env->stage = env_sustain;
+        env->step = 0;
+    } else {
+        env->stage = env_done; // released, or decayed to nothing
+        env->level = 0;
+        env->step = 0;
+    }
+}
+
+/* Key down: attack from wherever the level is now, so that hitting a key
+ * that is still sounding does not click. The attack time is for going all
+ * the way up from silence.
+ */
+void startEnvelope(EnvState *env, const Envelope *shape, int rate) {
+    ramp(env, env_attack, 1, shape->attack * rate * (1 - env->level));
+}
+
+/* Key up: fade out from the current level. The release time is for going
+ * down from full volume.
+ */
+void releaseEnvelope(EnvState *env, const Envelope *shape, int rate) {
+    if (env->stage != env_done) {
+        ramp(env, env_release, 0, shape->release * rate * env->level);
+    }
+}
+
+/* Gives the part of the next len samples that the envelope spends in one
+ * straight line: the level at its start in from and the change per sample
+ * in step. Returns how many samples that is and moves past them.
+ */
+int envelopeRamp(EnvState *env, const Envelope *shape, int rate, int len,
+        float *from, float *step) {
+    *from = env->level;
+    *step = env->step;
+    if (env->stage == env_sustain || env->stage == env_done) {
+        return len; // flat, for as long as it takes
+    }
+
+    int n = len < env->left ? len : env->left;
+    env->left -= n;
+    if (env->left == 0) {
+        nextStage(env, shape, rate);
+    } else {
+        env->level += env->step * n;
+    }
+    return n;
+}
@@ -0,0 +1,41 @@
+#ifndef ENV_H
+#define ENV_H
+
+#include <SDL2/SDL.h>
+
+/* Shape of an ADSR envelope: attack, decay and release are in seconds,
+ * sustain is the level held while the key stays down (1 is full volume)
+ */
+typedef struct Envelope {
+    float attack;
+    float decay;
+    float sustain;
+    float release;
+} Envelope;
+
+typedef enum EnvStage {
+    env_attack,
+    env_decay,
+    env_sustain,
+    env_release,
+    env_done        // silent, the voice can go
+} EnvStage;
+
+/* Where a voice is in its envelope. Every stage is a straight line from
+ * the level it starts at to its target, so a whole block of samples can be
+ * handed to the mixer as one ramp instead of working out every sample.
+ */
+typedef struct EnvState {
+    EnvStage stage;
+    float level;    // current level
+    float target;   // level at the end of this stage
+    float step;     // change in level per sample
+    int left;       // samples until the stage is over
+} EnvState;
+
+void startEnvelope(EnvState *env, const Envelope *shape, int rate);
+void releaseEnvelope(EnvState *env, const Envelope *shape, int rate);
+int envelopeRamp(EnvState *env, const Envelope *shape, int rate, int len,
+        float *from, float *step);
+
+#endif
@@ -0,0 +1,164 @@
+#include <math.h>
+#include "fft.h"
+
+/* Radix 2, decimation in time, on split real and imaginary arrays. A real
+ * signal of n samples goes in as n / 2 complex points, the even samples
+ * as the real parts and the odd ones as the imaginary parts, and the
+ * spectrum of the real signal is untangled from theirs afterwards. That
+ * halves the work of a complex transform of n points.
+ *
+ * Like most FFTs neither direction scales: inverseFft(forwardFft(x)) is
+ * n times x.
+ */
+
+/* Tables for transforms of n real samples, n a power of 2 of at least 4.
+ * Returns false if memory could not be had.
+ */
+bool setupFft(Fft *fft, int n) {
+    int half = n / 2;
+    fft->n = n;
+    fft->half = half;
+    fft->twiddle = SDL_malloc(sizeof(float) * half);
+    fft->rotate = SDL_malloc(sizeof(float) * 2 * (half + 1));
+    fft->reverse = SDL_malloc(sizeof(int) * half);
+    fft->work = SDL_malloc(sizeof(float) * 2 * half);
+    if (fft->twiddle == NULL || fft->rotate == NULL || fft->reverse == NULL ||
+            fft->work == NULL) {
+        freeFft(fft);
+        return false;
+    }
+    for (int j = 0; j < half / 2; j++) {
+        fft->twiddle[j] = (float)cos(2 * M_PI * j / half);
+        fft->twiddle[half / 2 + j] = (float)sin(2 * M_PI * j / half);
+    }
+    for (int k = 0; k <= half; k++) {
+        fft->rotate[k] = (float)cos(2 * M_PI * k / n);
+        fft->rotate[half + 1 + k] = (float)sin(2 * M_PI * k / n);
+    }
+    int bits = 0;
+    while ((1 << bits) < half) {
+        bits++;
+    }
+    for (int k = 0; k < half; k++) {
+        int r = 0;
+        for (int b = 0; b < bits; b++) {
+            r |= (k >> b & 1) << (bits - 1 - b);
+        }
+        fft->reverse[k] = r;
+    }
+    return true;
+}
+
+void freeFft(Fft *fft) {
+    SDL_free(fft->twiddle);
+    SDL_free(fft->rotate);
+    SDL_free(fft->reverse);
+    SDL_free(fft->work);
+    fft->twiddle = NULL;
+    fft->rotate = NULL;
+    fft->reverse = NULL;
+    fft->work = NULL;
+}
+
+/* The complex transform of half points that are in bit reversed order, in
+ * place. Swapping re and im makes it the inverse transform.
+ */
+static void butterflies(const Fft *fft, float *re, float *im) {
+    int half = fft->half;
+    const float *cosines = fft->twiddle;
+    const float *sines = fft->twiddle + half / 2;
+    for (int len = 2; len <= half; len *= 2) {
+        int span = len / 2;
+        int step = half / len;
+        for (int i = 0; i < half; i += len) {
+            for (int j = 0; j < span; j++) {
+                float c = cosines[j * step];
+                float s = sines[j * step];
+                int a = i + j;
+                int b = a + span;
+                // b times e^(-2 pi i j / len)
+                float tr = re[b] * c + im[b] * s;
+                float ti = im[b] * c - re[b] * s;
+                re[b] = re[a] - tr;
+                im[b] = im[a] - ti;
+                re[a] += tr;
+                im[a] += ti;
+            }
+        }
+    }
+}
+
+/* Spectrum of the n samples in in, into half + 1 bins of re and im
+ */
+void forwardFft(const Fft *fft, const float *in, float *re, float *im) {
+    int half = fft->half;
+    const float *cosines = fft->rotate;
+    const float *sines = fft->rotate + half + 1;
+    for (int k = 0; k < half; k++) {
+        int r = fft->reverse[k];
+        re[r] = in[2 * k];
+        im[r] = in[2 * k + 1];
+    }
+    butterflies(fft, re, im);
+
+    // point k is E + iO, E the transform of the even samples and O of the
+    // odd ones, and bin k is E + O turned by -2 pi k / n; point half - k
+    // gives both again, conjugated, which also makes bin half - k
+    float r0 = re[0];
+    float i0 = im[0];
+    re[0] = r0 + i0;
+    im[0] = 0;
+    re[half] = r0 - i0;
+    im[half] = 0;
+    for (int k = 1; k <= half / 2; k++) {
+        int j = half - k;
+        float c = cosines[k];
+        float s = sines[k];
+        float er = (re[k] + re[j]) * 0.5f;
+        float ei = (im[k] - im[j]) * 0.5f;
+        float odd_r = (im[k] + im[j]) * 0.5f;
+        float odd_i = (re[j] - re[k]) * 0.5f;
+        float tr = odd_r * c + odd_i * s;
+        float ti = odd_i * c - odd_r * s;
+        re[k] = er + tr;
+        im[k] = ei + ti;
+        re[j] = er - tr;
+        im[j] = ti - ei;
+    }
+}
+
+/* The n samples of the spectrum in half + 1 bins of re and im, times n.
+ * re and im are left as they are.
+ */
+void inverseFft(const Fft *fft, const float *re, const float *im, float *out) {
+    int half = fft->half;
+    const float *cosines = fft->rotate;
+    const float *sines = fft->rotate + half + 1;
+    float *zr = fft->work;
+    float *zi = fft->work + half;
+
+    // the same untangling backwards, into bit reversed order for the
+    // butterflies, and twice as loud, which saves the halving
+    zr[0] = re[0] + re[half];
+    zi[0] = re[0] - re[half];
+    for (int k = 1; k <= half / 2; k++) {
+        int j = half - k;
+        float c = cosines[k];
+        float s = sines[k];
+        float er = re[k] + re[j];
+        float ei = im[k] - im[j];
+        float dr = re[k] - re[j];
+        float di = im[k] + im[j];
+        float odd_r = dr * c - di * s;
+        float odd_i = dr * s + di * c;
+        zr[fft->reverse[k]] = er - odd_i;
+        zi[fft->reverse[k]] = ei + odd_r;
+        zr[fft->reverse[j]] = er + odd_i;
+        zi[fft->reverse[j]] = odd_r - ei;
+    }
+    butterflies(fft, zi, zr);
+    for (int k = 0; k < half; k++) {
+        out[2 * k] = zr[k];
+        out[2 * k + 1] = zi[k];
+    }
+}
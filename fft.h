@@ -0,0 +1,27 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+
+/* Fourier transform of n real samples, n a power of 2, done as a complex
+ * transform of n / 2 points. Spectra have n / 2 + 1 bins, from DC up to the
+ * Nyquist frequency, with the real and the imaginary parts in arrays of
+ * their own, which is what the vector kernels want. Everything is
+ * allocated by setupFft, transforming allocates nothing.
+ */
+typedef struct Fft {
+    int n;          // real samples
+    int half;       // complex points, n / 2
+    float *twiddle; // half / 2 cosines, then as many sines, of the points
+    float *rotate;  // half + 1 cosines and sines of the real transform
+    int *reverse;   // bit reversal of every point's index
+    float *work;    // 2 * half, for inverseFft
+} Fft;
+
+bool setupFft(Fft *fft, int n);
+void freeFft(Fft *fft);
+void forwardFft(const Fft *fft, const float *in, float *re, float *im);
+void inverseFft(const Fft *fft, const float *re, const float *im, float *out);
+
+#endif
@@ -0,0 +1,203 @@
+#include <math.h>
+#include "fm.h"
+
+/* Two operator FM the way the OPL2 does it: no floating point and no sin()
+ * per sample. An operator's phase is a 32 bit integer; the top 10 bits look
+ * up the sine as an attenuation in a quarter wave log-sin table, the
+ * envelope and the operator's level are added to that (a multiplication,
+ * in the log domain) and an exp table turns the sum back into a level of
+ * up to FM_FULL. The modulator's output moves the carrier's phase, and the
+ * modulator's own, through feedback.
+ *
+ * Each operator has its own envelope: an attack that speeds up as it gets
+ * louder, as on the chip, then a decay that is linear in attenuation (so
+ * exponential in level) down to the sustain level. The modulator's shapes
+ * the brightness, the carrier's the level; letting go of the key is left to
+ * the voice's envelope, so FM voices end like all others.
+ */
+
+#define ATTACK_STEP 256 // smallest change in the attack, 16.16 fixed point
+#define SIGN 0x8000     // in a wave entry, the rest is the attenuation
+
+// a period of each of the four waves, as attenuation and sign: the log-sin
+// of the quarter wave the chip has, mirrored and with the halves and
+// quarters the waves leave out as FM_SILENT
+static Uint16 waves[4][1024];
+static Uint16 exps[FM_SILENT + 1]; // FM_FULL * 2^(-i/256), 0 at the end
+static bool built;
+
+// the three OPL2 waves the wave forms stand for, see opl21At and the rest
+static const FmPatch patches[] = {
+    { { 0, 1 }, { 2, 2 }, { FM_DB(24), 0 }, { 0.002f, 0.002f },
+        { 1.0f, 2.0f }, { FM_DB(18), FM_DB(6) }, 3 },       // opl2_1
+    { { 0, 2 }, { 2, 2 }, { FM_DB(27), 0 }, { 0.002f, 0.002f },
+        { 0.6f, 1.5f }, { FM_DB(12), FM_DB(6) }, 0 },       // opl2_2
+    { { 0, 3 }, { 2, 2 }, { FM_DB(21), 0 }, { 0.002f, 0.002f },
+        { 0.4f, 2.5f }, { FM_DB(24), FM_DB(9) }, 5 },       // opl2_3
+};
+
+/* The patch a wave form is played with, or NULL if it is no FM one
+ */
+const FmPatch *fmPatch(WaveForm wave) {
+    if (wave < opl2_1 || wave > opl2_3) {
+        return NULL;
+    }
+    return &patches[wave - opl2_1];
+}
+
+/* Fills the tables, which the chip has in ROM. Main thread, before the
+ * first FM voice is rendered.
+ */
+void setupFm(void) {
+    if (built) {
+        return;
+    }
+    for (int i = 0; i < 256; i++) {
+        double s = sin((i + 0.5) * M_PI / 512);
+        int att = (int)(-log2(s) * 256 + 0.5);
+        for (int q = 0; q < 4; q++) {
+            int index = q * 256 + (q % 2 ? 255 - i : i);
+            int negative = q >= 2 ? SIGN : 0;
+            waves[0][index] = att | negative;
+            waves[1][index] = negative ? FM_SILENT : att;
+            waves[2][index] = att;
+            waves[3][index] = q % 2 ? FM_SILENT : att;
+        }
+    }
+    // the chip shifts a 256 entry table, a whole one saves that
+    for (int i = 0; i < FM_SILENT; i++) {
+        exps[i] = (Uint16)(FM_FULL * pow(2, -i / 256.0) + 0.5);
+    }
+    exps[FM_SILENT] = 0;
+    built = true;
+}
+
+/* A new voice: both operators start at the beginning of a period, silent
+ */
+void resetFm(FmVoice *fm) {
+    for (int i = 0; i < 2; i++) {
+        fm->op[i].phase = 0;
+        fm->op[i].env = FM_SILENT << 16;
+        fm->op[i].stage = fm_sustain;
+    }
+    fm->out[0] = 0;
+    fm->out[1] = 0;
+    fm->left = FM_ENV_STEP;
+}
+
+/* Key down: both envelopes attack from where they are
+ */
+void attackFm(FmVoice *fm) {
+    fm->op[0].stage = fm_attack;
+    fm->op[1].stage = fm_attack;
+}
+
+/* Output of an operator with the given wave at table index (wrapped to 10
+ * bits) and attenuation att. No branches: on top of the table entry it is
+ * one more lookup.
+ */
+static inline int opOut(const Uint16 *wave, int index, int att) {
+    int entry = wave[index & 1023];
+    att += entry & (SIGN - 1);
+    int level = exps[att < FM_SILENT ? att : FM_SILENT];
+    int negative = -(entry >> 15);
+    return (level ^ negative) - negative;
+}
+
+// what an envelope does per step, worked out once per buffer
+typedef struct EnvRates {
+    int shift;      // the attack takes away env >> shift
+    Uint32 decay;   // the decay adds this
+    Uint32 sustain; // until it gets here
+} EnvRates;
+
+static void stepEnv(FmOp *op, const EnvRates *r) {
+    if (op->stage == fm_attack) {
+        Uint32 down = (op->env >> r->shift) + ATTACK_STEP;
+        if (down >= op->env) {
+            op->env = 0;
+            op->stage = fm_decay;
+        } else {
+            op->env -= down;
+        }
+    } else if (op->stage == fm_decay) {
+        op->env += r->decay;
+        if (op->env >= r->sustain) {
+            op->env = r->sustain;
+            op->stage = fm_sustain;
+        }
+    }
+}
+
+/* Renders n samples of both operators, while the envelopes stay where they
+ * are. Feedback makes every sample wait for the last, so there is a loop
+ * without it for the patches that do not need it.
+ */
+static inline void runOps(FmVoice *fm, const FmPatch *patch,
+        const Uint32 *inc, float *out, int n, bool feedback) {
+    const Uint16 *mod_wave = waves[patch->wave[0]];
+    const Uint16 *car_wave = waves[patch->wave[1]];
+    int fb_shift = 9 - patch->feedback;
+    int mod_att = (fm->op[0].env >> 16) + patch->level[0];
+    int car_att = (fm->op[1].env >> 16) + patch->level[1];
+    // in locals, so that they stay in registers
+    Uint32 mod_phase = fm->op[0].phase;
+    Uint32 car_phase = fm->op[1].phase;
+    int out0 = fm->out[0];
+    int out1 = fm->out[1];
+    for (int i = 0; i < n; i++) {
+        int fb = feedback ? (out0 + out1) >> fb_shift : 0;
+        int m = opOut(mod_wave, (mod_phase >> 22) + fb, mod_att);
+        int c = opOut(car_wave, (car_phase >> 22) + m, car_att);
+        out0 = out1;
+        out1 = m;
+        out[i] = (float)c;
+        mod_phase += inc[0];
+        car_phase += inc[1];
+    }
+    fm->op[0].phase = mod_phase;
+    fm->op[1].phase = car_phase;
+    fm->out[0] = out0;
+    fm->out[1] = out1;
+}
+
+/* Renders len samples of a voice playing freq with patch into out, at full
+ * scale FM_FULL: bringing that down to 1 is left to the gain of the voice,
+ * which is applied anyway. Only adds, shifts and table lookups per sample,
+ * and the conversion of the result to float; the envelopes move every
+ * FM_ENV_STEP samples, wherever the buffers start.
+ */
+void renderFm(FmVoice *fm, const FmPatch *patch, double freq, int rate,
+        float *out, int len) {
+    Uint32 inc[2];
+    EnvRates rates[2];
+    double steps = (double)rate / FM_ENV_STEP; // of the envelopes a second
+    for (int i = 0; i < 2; i++) {
+        inc[i] = (Uint32)(freq * patch->mult[i] / 2 / rate * 4294967296.0);
+        // from silence to full the attack takes about 2^shift times the
+        // log of the range of env (about 19) steps
+        double n = patch->attack[i] * steps / 19.2;
+        int shift = n > 1 ? (int)log2(n) : 0;
+        rates[i].shift = shift < 20 ? shift : 20;
+        rates[i].sustain = (Uint32)patch->sustain[i] << 16;
+        double step = rates[i].sustain / (patch->decay[i] * steps);
+        rates[i].decay = step > 1 ? (Uint32)step : 1;
+    }
+
+    int i = 0;
+    while (i < len) {
+        int n = len - i < fm->left ? len - i : fm->left;
+        if (patch->feedback) {
+            runOps(fm, patch, inc, out + i, n, true);
+        } else {
+            runOps(fm, patch, inc, out + i, n, false);
+        }
+        i += n;
+        fm->left -= n;
+        if (fm->left == 0) {
+            stepEnv(&fm->op[0], &rates[0]);
+            stepEnv(&fm->op[1], &rates[1]);
+            fm->left = FM_ENV_STEP;
+        }
+    }
+}
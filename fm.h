@@ -0,0 +1,58 @@
+#ifndef FM_H
+#define FM_H
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+#include "osc.h"
+
+#define FM_FULL 4096        // what an operator puts out at full level
+#define FM_SILENT (13 << 8) // attenuation at which nothing is left of that
+#define FM_ENV_STEP 8       // samples per step of the envelopes, as on the
+                            // chip, whose envelopes run slower than its phase
+
+// attenuation of db decibels, in the units the tables use: 1/256 octave
+#define FM_DB(db) ((int)((db) * 256 / 6.0206 + 0.5))
+
+/* An instrument for the two operators, the modulator [0] and the carrier
+ * [1], the way an OPL2 channel is programmed
+ */
+typedef struct FmPatch {
+    Uint8 wave[2];      // OPL2 wave select: sine, half, absolute, pulse sine
+    Uint8 mult[2];      // frequency multiple in halves, 2 for the note's own
+    Uint16 level[2];    // attenuation, see FM_DB
+    float attack[2];    // seconds to come up from silence
+    float decay[2];     // and to fall from there to the sustain level
+    Uint16 sustain[2];  // attenuation it stays at while the key is down
+    Uint8 feedback;     // of the modulator into itself, 0 for none to 7
+} FmPatch;
+
+typedef enum FmStage {
+    fm_attack,
+    fm_decay,
+    fm_sustain
+} FmStage;
+
+/* One operator: a phase accumulator and an envelope, both integers
+ */
+typedef struct FmOp {
+    Uint32 phase;   // 2^32 is a period, the top 10 bits index the tables
+    Uint32 env;     // attenuation, 16.16 fixed point
+    FmStage stage;
+} FmOp;
+
+/* What an FM voice remembers from one buffer to the next
+ */
+typedef struct FmVoice {
+    FmOp op[2];     // modulator, carrier
+    int out[2];     // the modulator's last two outputs, for feedback
+    int left;       // samples until the envelopes take their next step
+} FmVoice;
+
+const FmPatch *fmPatch(WaveForm wave);
+void setupFm(void);
+void resetFm(FmVoice *fm);
+void attackFm(FmVoice *fm);
+void renderFm(FmVoice *fm, const FmPatch *patch, double freq, int rate,
+        float *out, int len);
+
+#endif
@@ -0,0 +1,200 @@
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "midi.h"
+
+/* MIDI input for players with a real keyboard: notes with their velocity,
+ * and the sustain pedal, from any channel. Nothing goes through SDL's event
+ * loop, the input thread pushes straight into engine->midi, which the audio
+ * thread reads alongside the queue of the computer keyboard. Notes that the
+ * piano has no key for are left out.
+ *
+ * To try it without a keyboard:
+ *
+ *     mkfifo midi.fifo
+ *     piano -M midi.fifo &
+ *     printf '\x90\x3c\x64' > midi.fifo      # C3 down, velocity 100
+ *     printf '\x3c\x00' > midi.fifo          # and up, in running status
+ */
+
+void resetMidiParser(MidiParser *parser) {
+    parser->status = 0;
+    parser->have = 0;
+}
+
+/* Takes the next byte of the stream. Returns true when that completes a
+ * channel message, which is then in msg: status and two data bytes, the
+ * second 0 for messages with one. Data bytes without a status byte first
+ * repeat the last one (running status). Real time bytes may come anywhere,
+ * even inside a message, and are skipped; other system messages end running
+ * status and are skipped with their data.
+ */
+bool parseMidi(MidiParser *parser, Uint8 byte, Uint8 *msg) {
+    if (byte >= 0xf8) {
+        return false;
+    }
+    if (byte & 0x80) {
+        parser->status = byte < 0xf0 ? byte : 0;
+        parser->have = 0;
+        return false;
+    }
+    if (parser->status == 0) {
+        return false;
+    }
+    parser->data[parser->have++] = byte;
+    // program change and channel pressure have one data byte
+    int need = (parser->status & 0xe0) == 0xc0 ? 1 : 2;
+    if (parser->have < need) {
+        return false;
+    }
+    msg[0] = parser->status;
+    msg[1] = parser->data[0];
+    msg[2] = need == 2 ? parser->data[1] : 0;
+    parser->have = 0;
+    return true;
+}
+
+#ifdef __linux__
+/* Sends a message the piano plays to the audio thread
+ */
+static void sendMessage(MidiInput *midi, const Uint8 *msg, Uint64 time) {
+    NoteEvent ev;
+    ev.time = time;
+    ev.velocity = msg[2];
+    switch (msg[0] & 0xf0) {
+        case 0x80:
+        case 0x90:
+            // a note on with velocity 0 is a note off
+            ev.key = keyForNote(midi->engine->keys, msg[1]);
+            ev.on = (msg[0] & 0xf0) == 0x90 && msg[2] > 0;
+            if (ev.key == NULL) {
+                return;
+            }
+            break;
+        case 0xb0:
+            if (msg[1] != MIDI_SUSTAIN) {
+                return;
+            }
+            ev.key = NULL;
+            ev.on = msg[2] >= 64;
+            break;
+        default:
+            return;
+    }
+    if (!pushEvent(&midi->engine->midi, &ev)) {
+        SDL_AtomicAdd(&midi->dropped, 1);
+    }
+}
+
+static int midiMain(void *arg) {
+    MidiInput *midi = arg;
+    struct pollfd fds[2] = {
+        { midi->fd, POLLIN, 0 },
+        { midi->wake[0], POLLIN, 0 },
+    };
+    Uint8 buf[256];
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        if (fds[1].revents) {
+            return 0; // see closeMidi
+        }
+        ssize_t len = read(midi->fd, buf, sizeof(buf));
+        // the bytes of one read arrived together, so they get one time
+        Uint64 now = SDL_GetPerformanceCounter();
+        if (len < 0 && (errno == EINTR || errno == EAGAIN)) {
+            continue;
+        }
+        if (len <= 0) {
+            return 0; // the device is gone
+        }
+        for (ssize_t i = 0; i < len; i++) {
+            Uint8 msg[3];
+            if (parseMidi(&midi->parser, buf[i], msg)) {
+                sendMessage(midi, msg, now);
+            }
+        }
+    }
+}
+#endif
+
+/* Starts reading MIDI from path for the engine, once the engine is set up.
+ * Returns NULL if that cannot be done, the reason is in SDL_GetError(), and
+ * on systems other than Linux always.
+ */
+MidiInput *openMidi(const char *path, Engine *engine) {
+#ifdef __linux__
+    MidiInput *midi = SDL_malloc(sizeof(MidiInput));
+    if (midi == NULL) {
+        SDL_OutOfMemory();
+        return NULL;
+    }
+    midi->engine = engine;
+    midi->thread = NULL;
+    midi->wake[0] = -1;
+    midi->wake[1] = -1;
+    resetMidiParser(&midi->parser);
+    SDL_AtomicSet(&midi->dropped, 0);
+
+    // a FIFO is opened for writing too: then it is never without a writer,
+    // and does not read as ended whenever the program feeding it stops
+    struct stat st;
+    bool fifo = stat(path, &st) == 0 && S_ISFIFO(st.st_mode);
+    midi->fd = open(path, (fifo ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+    if (midi->fd < 0 || pipe(midi->wake) < 0) {
+        SDL_SetError("%s", strerror(errno));
+    } else {
+        midi->thread = SDL_CreateThread(midiMain, "midi", midi);
+    }
+    if (midi->thread == NULL) {
+        closeMidi(midi);
+        return NULL;
+    }
+    return midi;
+#else
+    (void)path;
+    (void)engine;
+    SDL_SetError("MIDI input needs Linux");
+    return NULL;
+#endif
+}
+
+/* Stops the input thread and frees the input, NULL is fine
+ */
+void closeMidi(MidiInput *midi) {
+#ifdef __linux__
+    if (midi == NULL) {
+        return;
+    }
+    if (midi->thread) {
+        // the thread polls the pipe as well as the input
+        ssize_t wrote;
+        do {
+            wrote = write(midi->wake[1], "", 1);
+        } while (wrote < 0 && errno == EINTR);
+        SDL_WaitThread(midi->thread, NULL);
+    }
+    for (int i = 0; i < 2; i++) {
+        if (midi->wake[i] >= 0) {
+            close(midi->wake[i]);
+        }
+    }
+    if (midi->fd >= 0) {
+        close(midi->fd);
+    }
+    SDL_free(midi);
+#else
+    (void)midi;
+#endif
+}
@@ -0,0 +1,38 @@
+#ifndef MIDI_H
+#define MIDI_H
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+#include "synth.h"
+
+#define MIDI_SUSTAIN 64 // controller number of the sustain pedal
+
+/* Puts the bytes of a MIDI stream back together into messages
+ */
+typedef struct MidiParser {
+    Uint8 status;   // of the message being read, kept for running status,
+                    // 0 while in a system message or before the first
+    Uint8 data[2];  // its data bytes so far
+    int have;       // and how many there are
+} MidiParser;
+
+/* Reads raw MIDI from a character device (eg /dev/snd/midiC1D0) or a FIFO
+ * on a thread of its own and sends the notes and the sustain pedal to the
+ * audio thread, through a queue of the engine's that only this thread
+ * pushes to. Every event gets the time its bytes were read.
+ */
+typedef struct MidiInput {
+    Engine *engine;
+    int fd;         // what the bytes come from
+    int wake[2];    // a pipe closeMidi writes to, to stop the thread
+    MidiParser parser;
+    SDL_Thread *thread;
+    SDL_atomic_t dropped; // events the full queue had no room for
+} MidiInput;
+
+void resetMidiParser(MidiParser *parser);
+bool parseMidi(MidiParser *parser, Uint8 byte, Uint8 *msg);
+MidiInput *openMidi(const char *path, Engine *engine);
+void closeMidi(MidiInput *midi);
+
+#endif
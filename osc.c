@@ -0,0 +1,112 @@
+#include "dsp.h"
+#include "osc.h"
+
+/* The kernels in dsp.c produce the same shapes addFrequencies used to make
+ * with fmod and sin, but from a normalized phase. Values are in -1..1 (noise
+ * keeps its old -10..9 range), the caller applies the volume.
+ *
+ * Noise used to come from libc's random(), which takes a lock, cannot be
+ * repeated and was shared by all keys. Now every voice has generators of
+ * its own, seeded from noise_seed and the voice's note-on count, so the same
+ * seed and the same notes always give the same noise.
+ *
+ * Tolerance against the old fmod/sin code: the sine polynomial is off by less
+ * than 1e-7 and phase is computed in float per buffer, which can put it a few
+ * millionths of a period off. Together that is at most about 5e-5 in value,
+ * well within 1 LSB of the old Sint8 output, apart from the odd sample that
+ * lands right on a discontinuity (square, triangle, saw) and falls on the
+ * other side of it. `make bench` reports both.
+ *
+ * Square, triangle and saw are band-limited by default: PolyBLEP residuals
+ * smooth the sample either side of every jump (and PolyBLAMP the kinks of
+ * the triangle), which takes away most of the aliasing high notes have
+ * without the cost of oversampling. band_limited = false gives the naive
+ * shapes above.
+ */
+
+bool band_limited = true;
+Uint32 noise_seed = 1;
+
+const char *wave_names[WAVE_FORMS] = {
+    "square", "triangle", "saw", "noise",
+    "sine", "opl2_1", "opl2_2", "opl2_3"
+};
+
+/* Looks up a wave form by its name, returns false if there is no such wave
+ */
+bool parseWave(const char *name, WaveForm *wave) {
+    for (int w = 0; w < WAVE_FORMS; w++) {
+        if (SDL_strcmp(name, wave_names[w]) == 0) {
+            *wave = w;
+            return true;
+        }
+    }
+    return false;
+}
+
+void setOscFreq(Osc *osc, double freq, int rate) {
+    osc->inc = freq / rate;
+}
+
+// move on to where the next buffer starts, kept in double so that long
+// notes do not drift
+static void advanceOsc(Osc *osc, int len) {
+    osc->phase += osc->inc * len;
+    osc->phase -= (long)osc->phase;
+}
+
+// scrambles the bits of x, so that seeds next to each other give generators
+// that have nothing in common
+static Uint32 hash(Uint32 x) {
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+/* Gives the voice with the given note-on count its noise generators
+ */
+void seedNoise(Osc *osc, Uint32 serial) {
+    for (int l = 0; l < NOISE_LANES; l++) {
+        Uint32 s = hash(hash(noise_seed) + serial * NOISE_LANES + l);
+        osc->noise[l] = s ? s : 1; // xorshift would stay stuck at 0
+    }
+}
+
+/* The kernel that renders wave, specialized for it and for the CPU: the
+ * band-limited one if there is one and band_limited is set. NULL for noise,
+ * which runOsc knows. Worth looking up once per buffer, not per voice.
+ */
+OscKernel oscKernel(WaveForm wave) {
+    if (band_limited && dsp->blep[wave]) {
+        return dsp->blep[wave];
+    }
+    return dsp->osc[wave];
+}
+
+/* Writes len samples to out with a kernel from oscKernel and advances the
+ * oscillator
+ */
+void runOsc(Osc *osc, OscKernel kernel, float *out, int len) {
+    if (kernel) {
+        kernel(out, osc->phase, osc->inc, len);
+    } else {
+        dsp->noise(osc->noise, out, len);
+    }
+    advanceOsc(osc, len);
+}
+
+/* Writes len samples of the given wave to out and advances the oscillator
+ */
+void renderOsc(Osc *osc, WaveForm wave, float *out, int len) {
+    runOsc(osc, oscKernel(wave), out, len);
+}
+
+/* Same as renderOsc, but reading the wave from a table (see tables.h)
+ */
+void renderTable(Osc *osc, const float *table, float *out, int len) {
+    dsp->wavetable(out, table, osc->phase, osc->inc, len);
+    advanceOsc(osc, len);
+}
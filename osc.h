@@ -0,0 +1,51 @@
+#ifndef OSC_H
+#define OSC_H
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+
+typedef enum WaveForm {
+    square,
+    triangle,
+    saw,
+    noise,
+    sine,
+    opl2_1,
+    opl2_2,
+    opl2_3 
+} WaveForm;
+
+#define WAVE_FORMS (opl2_3 + 1)
+
+extern const char *wave_names[WAVE_FORMS];
+extern bool band_limited;
+extern Uint32 noise_seed;
+
+// renders len samples of a wave whose phase at sample 0 is start
+typedef void (*OscKernel)(float *out, float start, float inc, int len);
+
+#define NOISE_LANES 8   // interleaved noise generators per voice
+
+/* Phase accumulator for a single tone. The phase runs from 0 up to 1 over
+ * one period of the wave and moves on by inc (frequency / sample rate) for
+ * every sample, so no sample needs an fmod or a division.
+ *
+ * Noise has no phase but its own xorshift generators instead: sample i of a
+ * buffer comes from generator i % NOISE_LANES, so that a vector of them can
+ * be stepped at once.
+ */
+typedef struct Osc {
+    double phase;   // position in the current period, 0 <= phase < 1
+    double inc;     // how much of a period passes per sample
+    Uint32 noise[NOISE_LANES]; // generator states, never 0
+} Osc;
+
+bool parseWave(const char *name, WaveForm *wave);
+void setOscFreq(Osc *osc, double freq, int rate);
+void seedNoise(Osc *osc, Uint32 serial);
+void renderOsc(Osc *osc, WaveForm wave, float *out, int len);
+OscKernel oscKernel(WaveForm wave);
+void runOsc(Osc *osc, OscKernel kernel, float *out, int len);
+void renderTable(Osc *osc, const float *table, float *out, int len);
+
+#endif
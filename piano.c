@@ -1,399 +1,470 @@
+#include <math.h>
 #include <stdbool.h>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
-
-typedef enum WaveForm {
-    square,
-    triangle,
-    saw,
-    noise,
-    sine,
-    opl2_1,
-    opl2_2,
-    opl2_3 
-} WaveForm;
-
-typedef struct Key {
-    char tone[4];   // name of tone, eg A4
-    double freq;    // frequency of tone, eg 440hz
-    char key;       // keyboard scan code
-    SDL_Rect *rect; // rectangle on screen
-    bool on;        // currently playing
-    double wave_part;// place to store wave position between frames
-} Key;
-
-typedef struct Keys {
-    Key *white;     // pointer to array of 'white' keys
-    int w_len;      // how many white keys there are
-    Key *black;     // pointer to array of 'black' keys
-    int b_len;      // how many black keys there are
-} Keys;
+#include "config.h"
+#include "dsp.h"
+#include "midi.h"
+#include "reverb.h"
+#include "synth.h"
+
+#define LOW_LATENCY_FRAMES 128 // about 3 ms at 44.1 kHz
+#define WINDOW_W 1296       // 36 white keys of 36 pixels
+#define WINDOW_H 220
+#define OVERLAY_WIDTH 300   // pixels for a full bar
+#define OVERLAY_BAR 10      // height of a bar
+#define OVERLAY_MS 100      // how often the overlay is redrawn
+#define SEEK_SECONDS 10     // how far the arrow keys move a song
 
 static SDL_AudioSpec have;
 
-// TODO create a .ini config file (can read using lib iniParser) 
-static WaveForm wave = square;
-static Sint8 volume = 10;
-static double A4 = 432;
+#ifdef PIANO_DEBUG_ALLOC
+/* Debug build only (make DEBUG_ALLOC=1): route SDL's allocator through
+ * wrappers that count every call made from inside the audio callback, so
+ * that a stray SDL_malloc on the real-time thread cannot go unnoticed.
+ * Only SDL's allocator is watched, and only on the callback's own thread:
+ * malloc called directly and the render workers go unseen.
+ */
+static SDL_malloc_func real_malloc;
+static SDL_calloc_func real_calloc;
+static SDL_realloc_func real_realloc;
+static SDL_free_func real_free;
+static SDL_threadID audio_thread;
+static SDL_atomic_t in_callback;
+static SDL_atomic_t audio_allocs;
+
+static bool onAudioThread() {
+    return SDL_AtomicGet(&in_callback) && SDL_ThreadID() == audio_thread;
+}
+
+static void *debugMalloc(size_t size) {
+    if (onAudioThread()) {
+        SDL_AtomicAdd(&audio_allocs, 1);
+    }
+    return real_malloc(size);
+}
+
+static void *debugCalloc(size_t nmemb, size_t size) {
+    if (onAudioThread()) {
+        SDL_AtomicAdd(&audio_allocs, 1);
+    }
+    return real_calloc(nmemb, size);
+}
+
+static void *debugRealloc(void *mem, size_t size) {
+    if (onAudioThread()) {
+        SDL_AtomicAdd(&audio_allocs, 1);
+    }
+    return real_realloc(mem, size);
+}
 
-/* Helper to connect a keyboard key to a certain tone
+static void debugFree(void *mem) {
+    if (onAudioThread()) {
+        SDL_AtomicAdd(&audio_allocs, 1);
+    }
+    real_free(mem);
+}
+
+/* Installs the counting allocator, call before anything else touches SDL
  */
-bool keyToTone(Key* keys, int len, char *s, char c) {
-    for (int i = 0; i < len; i++) {
-        if (strncmp(keys[i].tone, s, 3) == 0) {
-            keys[i].key = c;
-            return true;
-        }
+void watchAllocations() {
+    SDL_GetMemoryFunctions(&real_malloc, &real_calloc,
+            &real_realloc, &real_free);
+    SDL_SetMemoryFunctions(debugMalloc, debugCalloc, debugRealloc, debugFree);
+}
+
+static void enterCallback() {
+    audio_thread = SDL_ThreadID();
+    SDL_AtomicSet(&in_callback, 1);
+}
+
+static void leaveCallback() {
+    SDL_AtomicSet(&in_callback, 0);
+    int allocs = SDL_AtomicSet(&audio_allocs, 0);
+    if (allocs) {
+        SDL_LogCritical(SDL_LOG_CATEGORY_AUDIO,
+                "%d allocator call(s) on the audio thread!", allocs);
+        abort();
     }
-    return false;
 }
+#endif
 
-/* initializes arrays of black and white struct Key, starting from the key
- * indicated by s_key in s_octave, ending on e_key in e_octave
- *   alwas start and end with a white key 
+/* Runs on SDL's real-time audio thread, see renderAudio
  */
-void setupKeys(Keys* keys,
-        char s_key, int s_octave, char e_key, int e_octave) {
-    extern double A4;
-
-    Key* white = keys->white;
-    Key* black = keys->black;
-
-    // start by makeing sure the everything is zero
-    SDL_memset(white, 0, sizeof(Key) * keys->w_len);
-    SDL_memset(black, 0, sizeof(Key) * keys->b_len);
-
-    // generate tonal frequencies based on our A4 val
-    double tone = A4;
-    double tones[12];
-    double next_octave = A4 * 2;
-    for (int i = 0; i < 12; i++) {
-        tones[i] = tone;
-        tone = tone / 2 * 3;
-        if (tone > next_octave) {
-            tone = tone / 2;
+void AudioCallback(void *userdata, Uint8 *stream, int len){
+#ifdef PIANO_DEBUG_ALLOC
+    enterCallback();
+#endif
+
+    renderAudio((Engine*)userdata, stream, len);
+
+#ifdef PIANO_DEBUG_ALLOC
+    leaveCallback();
+#endif
+}
+
+/* Which key is under every column of pixels of the window, black and
+ * white, so that finding the key under the mouse takes two lookups
+ */
+typedef struct KeyMap {
+    Key *white[WINDOW_W + 1];
+    Key *black[WINDOW_W + 1];
+} KeyMap;
+
+static bool isInside(const SDL_Rect *rect, int x, int y) {
+    return x >= rect->x && x <= rect->x + rect->w &&
+        y >= rect->y && y <= rect->y + rect->h;
+}
+
+/* Fills in the map from the rectangles of the keys. Where two keys share a
+ * column (their edges touch) the first one gets it.
+ */
+static void setupKeyMap(KeyMap *map, Keys *keys) {
+    SDL_memset(map, 0, sizeof(*map));
+    for (int i = keys->w_len - 1; i >= 0; i--) {
+        SDL_Rect *r = keys->white[i].rect;
+        for (int x = r->x; x <= r->x + r->w && x <= WINDOW_W; x++) {
+            map->white[x] = &keys->white[i];
         }
     }
-    // sort them ascending
-    double sorted[12];
-    for (int i = 0; i < 12; i++) {
-        double smallest = 100000;
-        int small_pos = -1;
-        for (int j = 0; j < 12; j++) {
-            if (tones[j] < smallest) {
-                smallest = tones[j];
-                small_pos = j;
-            }
-        }
-        sorted[i] = tones[small_pos];
-        tones[small_pos] = 100000;
-    }
-    // go to requested start octave (cannot be > 4)
-    int octave = 4;
-    while (octave > s_octave) {
-        for (int i = 0; i < 12; i++) {
-            sorted[i] /= 2;
-        }
-        octave--;
-    }
-    // go to requested start key
-    char bw[] = {'w','b','w','w','b','w','b','w','w','b','w','b'};
-    int index = 0;
-    char k = 'A';
-    while (k < s_key) {
-        index++;
-        if (bw[index] == 'b') {
-            index++;
+    for (int i = keys->b_len - 1; i >= 0; i--) {
+        SDL_Rect *r = keys->black[i].rect;
+        for (int x = r->x; x <= r->x + r->w && x <= WINDOW_W; x++) {
+            map->black[x] = &keys->black[i];
         }
-        k++;
-    }
-    // setup keys of the first (requested) octave
-    int wi = 0;
-    int bi = 0;
-    while (index < 12) {
-        if (bw[index] == 'w') {
-            white[wi].tone[0] = k;
-            white[wi].tone[1] = 0x30 + octave;
-            white[wi].freq = sorted[index];
-            wi++;
-        } else { // 'b'
-            black[bi].tone[0] = k;
-            black[bi].tone[1] = 0x30 + octave;
-            black[bi].tone[2] = '#';
-            black[bi].freq = sorted[index];
-            bi++;
-        }
-        if (index < 11 && bw[index + 1] == 'w') {
-            k++;
+    }
+}
+
+/* The key at x, y: the black keys lie on top of the white ones
+ */
+static Key *keyAt(const KeyMap *map, int x, int y) {
+    if (x < 0 || x > WINDOW_W) {
+        return NULL;
+    }
+    Key *black = map->black[x];
+    if (black && isInside(black->rect, x, y)) {
+        return black;
+    }
+    Key *white = map->white[x];
+    if (white && isInside(white->rect, x, y)) {
+        return white;
+    }
+    return NULL;
+}
+
+/* What the window shows and what has to be painted again. A key is only
+ * marked when its note starts or ends; the main loop paints the marked keys
+ * into the keyboard texture at most once per display frame, copies that to
+ * the window and puts the overlay on top. So however fast the input comes,
+ * the UI costs at most one paint of 61 keys and one copy per frame.
+ */
+typedef struct Screen {
+    SDL_Renderer *renderer;
+    SDL_Texture *keyboard; // the keys as they look now, NULL if the
+                           // renderer cannot draw into textures
+    bool down[NOTES];   // keys drawn as pressed, see takeHeld
+    bool pressed[NOTES]; // keys held on the keyboard or with the mouse
+    bool marked[NOTES]; // keys that have to be drawn again
+    Key *dirty[NOTES];  // and the same as a list
+    int count;
+    bool stale;         // the window has to be painted even so
+    Uint32 frame_ms;    // one refresh of the display
+    Uint32 painted;     // SDL_GetTicks() of the last paint
+} Screen;
+
+static void markKey(Screen *screen, Key *key) {
+    if (!screen->marked[key->note]) {
+        screen->marked[key->note] = true;
+        screen->dirty[screen->count++] = key;
+    }
+}
+
+static void markAll(Screen *screen, Keys *keys) {
+    for (int i = 0; i < keys->w_len; i++) {
+        markKey(screen, &keys->white[i]);
+    }
+    for (int i = 0; i < keys->b_len; i++) {
+        markKey(screen, &keys->black[i]);
+    }
+}
+
+/* Sends a note to the audio thread, the key lights up once it plays
+ */
+static void playKey(Engine *engine, Screen *screen, Key *key, bool on) {
+    sendNote(engine, key, on);
+    screen->pressed[key->note] = on;
+}
+
+/* Marks the keys whose notes the engine has started or let go since the
+ * last look, whether the keyboard, the mouse, a song or MIDI input played
+ * them
+ */
+static void takeHeld(Screen *screen, Keys *keys, Engine *engine) {
+    for (int i = 0; i < keys->w_len + keys->b_len; i++) {
+        Key *key = i < keys->w_len ? &keys->white[i] :
+            &keys->black[i - keys->w_len];
+        bool held = noteHeld(engine, key->note);
+        if (held != screen->down[key->note]) {
+            screen->down[key->note] = held;
+            markKey(screen, key);
         }
-        index++;
-    }
-    octave++;
-    for (int i = 0; i < 12; i++) {
-        sorted[i] *= 2;
-    }
-    // do all the in-between octaves
-    while (octave < e_octave) {
-        k = 'A';
-        for (index = 0; index < 12; index++) {
-            if (bw[index] == 'w') {
-                white[wi].tone[0] = k;
-                white[wi].tone[1] = 0x30 + octave;
-                white[wi].freq = sorted[index];
-                wi++;
-            } else { // 'b'
-                black[bi].tone[0] = k;
-                black[bi].tone[1] = 0x30 + octave;
-                black[bi].tone[2] = '#';
-                black[bi].freq = sorted[index];
-                bi++;
+    }
+}
+
+static void setColor(SDL_Renderer *renderer, Uint32 rgb, Uint8 alpha) {
+    SDL_SetRenderDrawColor(renderer, rgb >> 16, (rgb >> 8) & 0xff, rgb & 0xff,
+            alpha);
+}
+
+/* Draws a single key, a pressed one in blue
+ */
+static void drawKey(Screen *screen, const Key *key) {
+    bool black = key->tone[2] == '#';
+    bool down = screen->down[key->note];
+    if (black) {
+        setColor(screen->renderer, down ? 0x2850a0 : 0x000000, 0xaa);
+        SDL_RenderFillRect(screen->renderer, key->rect);
+        setColor(screen->renderer, 0xffffff, 0xff);
+    } else {
+        setColor(screen->renderer, down ? 0xa8c8ff : 0xffffff, 0xff);
+        SDL_RenderFillRect(screen->renderer, key->rect);
+        setColor(screen->renderer, 0x000000, 0xaa);
+    }
+    SDL_RenderDrawRect(screen->renderer, key->rect);
+}
+
+/* Brings the keyboard up to date and copies it to the window. Only marked
+ * keys are drawn, a white one with the black keys that lie on its edges.
+ * Without a keyboard texture everything is drawn every time, as the window
+ * keeps nothing between frames.
+ */
+static void paintKeys(Screen *screen, Keys *keys, const KeyMap *map) {
+    SDL_Renderer *renderer = screen->renderer;
+    if (screen->keyboard) {
+        SDL_SetRenderTarget(renderer, screen->keyboard);
+    } else {
+        markAll(screen, keys);
+    }
+    // white keys first, the black ones go over them
+    for (int i = 0; i < screen->count; i++) {
+        Key *key = screen->dirty[i];
+        if (key->tone[2] != '#') {
+            drawKey(screen, key);
+            Key *left = map->black[key->rect->x];
+            Key *right = map->black[key->rect->x + key->rect->w];
+            if (left && !screen->marked[left->note]) {
+                drawKey(screen, left);
             }
-            if (index < 11 && bw[index + 1] == 'w') {
-                k++;
+            if (right && !screen->marked[right->note]) {
+                drawKey(screen, right);
             }
         }
-        octave++;
-        for (int i = 0; i < 12; i++) {
-            sorted[i] *= 2;
-        }
     }
-    // then the last octave
-    index = 0;
-    k = 'A';
-    while (k <= e_key && wi < keys->w_len) {
-        if (bw[index] == 'w') {
-            white[wi].tone[0] = k;
-            white[wi].tone[1] = 0x30 + octave;
-            white[wi].freq = sorted[index];
-            wi++;
-        } else { // 'b'
-            black[bi].tone[0] = k;
-            black[bi].tone[1] = 0x30 + octave;
-            black[bi].tone[2] = '#';
-            black[bi].freq = sorted[index];
-            bi++;
+    for (int i = 0; i < screen->count; i++) {
+        Key *key = screen->dirty[i];
+        if (key->tone[2] == '#') {
+            drawKey(screen, key);
         }
-        if (index < 11 && bw[index + 1] == 'w') {
-            k++;
-        }
-        index++;
-    }
-
-    // TODO these bindings should probably be read from a config file
-    keyToTone(white, 36, "C2", '1');
-    keyToTone(white, 36, "D2", '2');
-    keyToTone(white, 36, "E2", '3');
-    keyToTone(white, 36, "F2", '4');
-    keyToTone(white, 36, "G2", '5');
-    keyToTone(white, 36, "A3", '6');
-    keyToTone(white, 36, "B3", '7');
-    keyToTone(white, 36, "C3", '8');
-    keyToTone(white, 36, "D3", '9');
-    keyToTone(white, 36, "E3", '0');
-    keyToTone(white, 36, "F3", 'q');
-    keyToTone(white, 36, "G3", 'w');
-    keyToTone(white, 36, "A4", 'e');
-    keyToTone(white, 36, "B4", 'r');
-    keyToTone(white, 36, "C4", 't');
-    keyToTone(white, 36, "D4", 'y');
-    keyToTone(white, 36, "E4", 'u');
-    keyToTone(white, 36, "F4", 'i');
-    keyToTone(white, 36, "G4", 'o');
-    keyToTone(white, 36, "A5", 'p');
-    keyToTone(white, 36, "B5", 'a');
-    keyToTone(white, 36, "C5", 's');
-    keyToTone(white, 36, "D5", 'd');
-    keyToTone(white, 36, "E5", 'f');
-    keyToTone(white, 36, "F5", 'g');
-    keyToTone(white, 36, "G5", 'h');
-    keyToTone(white, 36, "A6", 'j');
-    keyToTone(white, 36, "B6", 'k');
-    keyToTone(white, 36, "C6", 'l');
-    keyToTone(white, 36, "D6", 'z');
-    keyToTone(white, 36, "E6", 'x');
-    keyToTone(white, 36, "F6", 'c');
-    keyToTone(white, 36, "G6", 'v');
-    keyToTone(white, 36, "A7", 'b');
-    keyToTone(white, 36, "B7", 'n');
-    keyToTone(white, 36, "C7", 'm');
-
-    keyToTone(black, 25, "C2#", '1');
-    keyToTone(black, 25, "D2#", '2');
-    keyToTone(black, 25, "F2#", '4');
-    keyToTone(black, 25, "G2#", '5');
-    keyToTone(black, 25, "A3#", '6');
-    keyToTone(black, 25, "C3#", '8');
-    keyToTone(black, 25, "D3#", '9');
-    keyToTone(black, 25, "F3#", 'q');
-    keyToTone(black, 25, "G3#", 'w');
-    keyToTone(black, 25, "A4#", 'e');
-    keyToTone(black, 25, "C4#", 't');
-    keyToTone(black, 25, "D4#", 'y');
-    keyToTone(black, 25, "F4#", 'i');
-    keyToTone(black, 25, "G4#", 'o');
-    keyToTone(black, 25, "A5#", 'p');
-    keyToTone(black, 25, "C5#", 's');
-    keyToTone(black, 25, "D5#", 'd');
-    keyToTone(black, 25, "F5#", 'g');
-    keyToTone(black, 25, "G5#", 'h');
-    keyToTone(black, 25, "A6#", 'j');
-    keyToTone(black, 25, "C6#", 'l');
-    keyToTone(black, 25, "D6#", 'z');
-    keyToTone(black, 25, "F6#", 'c');
-    keyToTone(black, 25, "G6#", 'v');
-    keyToTone(black, 25, "A7#", 'b');
+        screen->marked[key->note] = false;
+    }
+    screen->count = 0;
+    if (screen->keyboard) {
+        SDL_SetRenderTarget(renderer, NULL);
+        SDL_RenderCopy(renderer, screen->keyboard, NULL, NULL);
+    }
 }
 
-/* Helper to put frequency waves into the audio stream
+/* Draws a bar of width w for value out of full, in the given color
  */
-int addFrequencies(Sint32 *audio, int alen, Key* keys, int klen) {
-    extern WaveForm wave;
-    extern SDL_AudioSpec have; // only works if we actually have Sint8
-    extern Sint8 volume;
-
-    // find which keys are pressed and mix in their frequencies
-    int pressed = 0;
-    for (int k = 0; k < klen; k++) {
-        if (keys[k].on && keys[k].freq) {
-            pressed += 1;
-
-            double tone = have.freq / keys[k].freq;
-            double part = 0;
-            if (wave == square) {
-                double half = tone / 2;
-                for ( int i = 0; i < alen; i++ ) {
-                    part = fmod(keys[k].wave_part + i, tone);
-                    if ( part < half ) {
-                        audio[i] -= volume;
-                    } else {
-                        audio[i] += volume;
-                    }
-                }
-            } else if (wave == triangle) {
-                double qtone = tone * 0.35;
-                double htone = tone * 0.5;
-                double ttone = tone * 0.75;
-                for (int i = 0; i < alen; i++) {
-                    part = fmod(keys[k].wave_part + i, tone);
-                    if (part <= qtone) {
-                        audio[i] = (part / qtone) * volume;
-                    } else if (part <= htone) {
-                        audio[i] = (1 - (part - qtone) / qtone) * volume; 
-                    } else if (part <= ttone) {
-                        audio[i] = (0 - (part - htone) / qtone) * volume;
-                    } else { // the last quarter of the 'wave'
-                        audio[i] = (-1 + (part - ttone) / qtone) * volume;
-                    }
-                }
-            } else if (wave == saw) {
-                for (int i = 0; i < alen; i++) {
-                    part = fmod(keys[k].wave_part + i, tone);
-                    audio[i] = (-1.0 + part/tone*2) * volume;
-                }
-            } else if (wave == noise) {
-                for (int i = 0; i < alen; i++) {
-                    audio[i] = ((random() % 20) - 10) * volume; 
-                }
-            } else if (wave == sine) {
-                double sine_tone = tone / (2 * M_PI);
-                for (int i = 0; i < alen; i++) {
-                    part = fmod(keys[k].wave_part + i, tone);
-                    audio[i] = sin(part / sine_tone) * volume;
-                }
-            } else if (wave == opl2_1) {
-                double sine_tone = tone / (2 * M_PI);
-                double htone = tone * 0.5;
-                for (int i = 0; i < alen; i++) {
-                    part = fmod(keys[k].wave_part + i, tone);
-                    if (part <= htone) {
-                        audio[i] = sin(part / sine_tone) * volume;
-                    } else {
-                        audio[i] = 0;
-                    }
-                }
-            } else if (wave == opl2_2) {
-                double sine_tone = tone / (2 * M_PI);
-                double htone = tone * 0.5;
-                for (int i = 0; i < alen; i++) {
-                    part = fmod(keys[k].wave_part + i, tone);
-                    if (part <= htone) {
-                        audio[i] = sin(part / sine_tone) * volume;
-                    } else {
-                        audio[i] = -sin(part / sine_tone) * volume;
-                    }
-                }
-            } else if (wave == opl2_3) {
-                double sine_tone = tone / (2 * M_PI);
-                double qtone = tone * 0.35;
-                double htone = tone * 0.5;
-                double ttone = tone * 0.75;
-                for (int i = 0; i < alen; i++) {
-                    part = fmod(keys[k].wave_part + i, tone);
-                    if (part <= qtone) {
-                        audio[i] = sin(part / sine_tone) * volume;
-                    } else if (part <= htone) {
-                        audio[i] = 0;
-                    } else if (part <= ttone) {
-                        audio[i] = -sin(part / sine_tone) * volume;
-                    } else { // the last quarter of the 'wave'
-                        audio[i] = 0;
-                    }
-                }
-            }
+static void drawBar(SDL_Renderer *renderer, int x, int y, int w,
+        double value, double full, Uint32 rgb) {
+    SDL_Rect bar = { x, y, 0, OVERLAY_BAR };
+    double part = full > 0 ? value / full : 0;
+    bar.w = (int)(w * (part < 0 ? 0 : part > 1 ? 1 : part));
+    setColor(renderer, rgb, 0xff);
+    SDL_RenderFillRect(renderer, &bar);
+}
 
-            // store where we are in the wave, so that we can continue there
-            // when generating the next sample
-            keys[k].wave_part = part;
-        }
+/* Profiling overlay in the bottom left corner, over the white keys. Three
+ * bars: the time the last buffer took out of its playing time, split into
+ * gather (grey), oscillators (blue), mixing (green), effects (cyan),
+ * normalize (yellow) and copying for the recorder (purple) with red past
+ * the deadline; sounding
+ * voices out of the polyphony; and the level meter: peak (light) and RMS
+ * (dark) green, with what the limiter takes off in orange from the right.
+ * The numbers go in the window title.
+ */
+static void drawOverlay(SDL_Window *window, SDL_Renderer *renderer,
+        const BufferStats *b, int polyphony) {
+    SDL_Rect panel = { 4, 150, OVERLAY_WIDTH + 8, 3 * OVERLAY_BAR + 16 };
+    int x = panel.x + 4;
+    int y = panel.y + 4;
+    int w = OVERLAY_WIDTH;
+
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(renderer, 0x20, 0x20, 0x20, 0xc0);
+    SDL_RenderFillRect(renderer, &panel);
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+
+    double stages[] = { b->gather, b->osc, b->mix, b->effects, b->normalize,
+        b->record };
+    Uint32 colors[] = { 0x909090, 0x4080ff, 0x40c040, 0x40c0c0, 0xe0c030,
+        0xb060e0 };
+    double used = 0;
+    for (int i = 0; i < (int)SDL_arraysize(stages); i++) {
+        int from = (int)(w * (used / b->budget < 1 ? used / b->budget : 1));
+        drawBar(renderer, x + from, y, w - from, stages[i], b->budget,
+                colors[i]);
+        used += stages[i];
+    }
+    if (b->total > b->budget) {
+        drawBar(renderer, x + w - 4, y, 4, 1, 1, 0xff3030);
     }
-    return pressed;
+    y += OVERLAY_BAR + 4;
+    drawBar(renderer, x, y, w, b->voices, polyphony, 0x4080ff);
+    y += OVERLAY_BAR + 4;
+    drawBar(renderer, x, y, w, b->peak, 1, 0x80e080);
+    drawBar(renderer, x, y, w, b->rms, 1, 0x308030);
+    if (b->limiter < 1) {
+        int cut = (int)(w * (1 - b->limiter));
+        drawBar(renderer, x + w - cut, y, cut, 1, 1, 0xff9020);
+    }
+
+    char title[192];
+    SDL_snprintf(title, sizeof(title), "piano - %.2f of %.2f ms (osc %.2f, "
+            "mix %.2f, fx %.2f, out %.2f), %d voices, peak %.1f dB, "
+            "rms %.1f dB, limiter %.1f dB",
+            b->total * 1000, b->budget * 1000, b->osc * 1000, b->mix * 1000,
+            b->effects * 1000, b->normalize * 1000, b->voices,
+            b->peak > 0 ? 20 * SDL_log10(b->peak) : -INFINITY,
+            b->rms > 0 ? 20 * SDL_log10(b->rms) : -INFINITY,
+            20 * SDL_log10(b->limiter));
+    SDL_SetWindowTitle(window, title);
 }
 
-void AudioCallback(void *userdata, Uint8 *stream, int len){
-    Keys *keys = (Keys*)userdata;
-
-    // first ensure silence in the stream
-    SDL_memset(stream, have.silence, len);
-
-    // create an audio stream to contain all pressed keys in one
-    Sint32 *audio = SDL_malloc(sizeof(Sint32) * len);
-    SDL_memset(audio, 0, sizeof(Sint32) * len);
-
-    int pressed = 0;
-    pressed += addFrequencies(audio, len, keys->white, keys->w_len);
-    pressed += addFrequencies(audio, len, keys->black, keys->b_len);
-
-    // normalize our audio into the stream
-    if (pressed) {
-        for (int i = 0; i < len; i++) {
-            int val = audio[i] / pressed;
-            if (val > 127) {
-                val = 127;
-            } else if (val < -128) {
-                val = -128;
+/* Reads the config file again after it changed and applies it over the
+ * defaults, so that a setting that was taken out goes back to what it was.
+ * Only the settings that differ from the last config, in applied, are
+ * changed. A file with an error in it changes nothing. When the bindings
+ * change the keys held down from the keyboard are let go, or their key up
+ * would find another key.
+ */
+static void reloadConfig(const char *path, const Config *defaults,
+        Config *applied, Keys *keys, Engine *engine, Screen *screen,
+        const Key *mouse) {
+    static Config config;
+    static Key *by_char[2][KEY_CHARS];
+    config = *defaults;
+    if (!readConfig(path, keys, &config)) {
+        return;
+    }
+    SDL_memcpy(by_char, keys->by_char, sizeof(by_char));
+    bool ok = applyConfig(&config, applied, keys, engine);
+    *applied = config;
+    if (!ok) {
+        SDL_Log("Not enough memory to retune to %.2f Hz", config.a4);
+    }
+    if (SDL_memcmp(by_char, keys->by_char, sizeof(by_char)) != 0) {
+        for (int i = 0; i < keys->w_len + keys->b_len; i++) {
+            Key *key = i < keys->w_len ? &keys->white[i] :
+                &keys->black[i - keys->w_len];
+            if (screen->pressed[key->note] && key != mouse) {
+                playKey(engine, screen, key, false);
             }
-            stream[i] = val;
         }
     }
-    SDL_free(audio);
-}
-
-bool isInside(SDL_Rect *rect, SDL_MouseButtonEvent *event) {
-    return event->x >= rect->x && 
-        event->x <= rect->x + rect->w &&
-        event->y >= rect->y &&
-        event->y <= rect->y + rect->h;
+    SDL_Log("Read %s: A4 %.2f Hz, %s, volume %d", path, config.a4,
+            wave_names[config.wave], config.volume);
 }
 
-bool isInsideMotion(SDL_Rect *rect, SDL_MouseMotionEvent *event) {
-    return event->x >= rect->x && 
-        event->x <= rect->x + rect->w &&
-        event->y >= rect->y &&
-        event->y <= rect->y + rect->h;
+static void usage() {
+    printf("usage: piano [-b buffer] [-d] [-i config.ini] [-j threads] [-l] "
+            "[-m song.mid]\n"
+            "             [-n] [-o out.wav] [-p polyphony] [-s stats.csv] "
+            "[-t] [-M midi]\n"
+            "             [-R ir.wav] [-S seed]\n"
+            "  -b  frames per audio buffer, 1024 by default\n"
+            "  -d  deterministic: threads always share the voices out alike\n"
+            "  -i  tuning, wave form, volume and keys, read again whenever\n"
+            "      the file changes, piano.ini by default\n"
+            "  -j  threads that render voices, 1 to %d\n"
+            "  -l  low latency: %d frame buffers unless -b says otherwise,\n"
+            "      and no more voices than can be rendered in time\n"
+            "  -m  play a MIDI file along, the arrow keys seek %d s back or\n"
+            "      forward\n"
+            "  -n  naive square, triangle and saw, without band-limiting\n"
+            "  -o  record everything that is played, as .wav or, for a name\n"
+            "      ending in .raw, bare samples in the device's format\n"
+            "  -s  write the timing of the last buffers to a CSV file on exit\n"
+            "  -t  play from precomputed wave tables\n"
+            "  -M  play from a MIDI device or FIFO, eg /dev/snd/midiC1D0\n"
+            "  -R  reverb with the impulse response of a room from a .wav\n"
+            "      file, F9 turns it off and on\n"
+            "  -S  seed for the noise, different every time by default\n",
+            MAX_THREADS, LOW_LATENCY_FRAMES, SEEK_SECONDS);
 }
 
-int main() {
+int main(int argc, char *argv[]) {
     extern WaveForm wave;
+    int frames = 0;
+    const char *csv = NULL;
+    const char *ini = "piano.ini";
+    const char *out = NULL;
+    const char *midi = NULL;
+    const char *midi_in = NULL;
+    const char *ir = NULL;
+    noise_seed = (Uint32)SDL_GetPerformanceCounter();
+    for (int arg = 1; arg < argc; arg++) {
+        if (SDL_strcmp(argv[arg], "-l") == 0) {
+            low_latency = true;
+        } else if (SDL_strcmp(argv[arg], "-n") == 0) {
+            band_limited = false;
+        } else if (SDL_strcmp(argv[arg], "-d") == 0) {
+            deterministic = true;
+        } else if (SDL_strcmp(argv[arg], "-j") == 0 && arg + 1 < argc) {
+            render_threads = SDL_atoi(argv[++arg]);
+        } else if (SDL_strcmp(argv[arg], "-t") == 0) {
+            wave_tables = true;
+        } else if (SDL_strcmp(argv[arg], "-S") == 0 && arg + 1 < argc) {
+            noise_seed = SDL_strtoul(argv[++arg], NULL, 0);
+        } else if (SDL_strcmp(argv[arg], "-b") == 0 && arg + 1 < argc) {
+            frames = SDL_atoi(argv[++arg]);
+        } else if (SDL_strcmp(argv[arg], "-p") == 0 && arg + 1 < argc) {
+            polyphony = SDL_atoi(argv[++arg]);
+        } else if (SDL_strcmp(argv[arg], "-s") == 0 && arg + 1 < argc) {
+            csv = argv[++arg];
+        } else if (SDL_strcmp(argv[arg], "-i") == 0 && arg + 1 < argc) {
+            ini = argv[++arg];
+        } else if (SDL_strcmp(argv[arg], "-o") == 0 && arg + 1 < argc) {
+            out = argv[++arg];
+        } else if (SDL_strcmp(argv[arg], "-m") == 0 && arg + 1 < argc) {
+            midi = argv[++arg];
+        } else if (SDL_strcmp(argv[arg], "-M") == 0 && arg + 1 < argc) {
+            midi_in = argv[++arg];
+        } else if (SDL_strcmp(argv[arg], "-R") == 0 && arg + 1 < argc) {
+            ir = argv[++arg];
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (frames == 0) {
+        frames = low_latency ? LOW_LATENCY_FRAMES : 1024;
+    }
+    if (frames < MIN_FRAMES || frames > MAX_FRAMES) {
+        printf("-b takes %d to %d frames\n", MIN_FRAMES, MAX_FRAMES);
+        return 1;
+    }
+    if (polyphony < 1 || polyphony > NOTES ||
+            render_threads < 1 || render_threads > MAX_THREADS) {
+        usage();
+        return 1;
+    }
+
+#ifdef PIANO_DEBUG_ALLOC
+    watchAllocations();
+#endif
+    setupKernels();
     // create our keys data structures
     Key white[36];
     Key black[25];
@@ -404,6 +475,17 @@ int main() {
     keys.b_len = 25;
     setupKeys(&keys, 'C', 2, 'C', 7);
 
+    // what the config file says goes over the defaults, now and whenever
+    // it changes
+    static Config defaults;
+    static Config config;
+    defaultConfig(&defaults);
+    config = defaults;
+    if (!readConfig(ini, &keys, &config)) {
+        return 1;
+    }
+    applyConfig(&config, NULL, &keys, NULL);
+
     // we cannot make this a console only application because there are 
     // no keyboard events unless we have video initialized
     if (SDL_Init(SDL_INIT_EVERYTHING) < 0) {
@@ -411,12 +493,13 @@ int main() {
         return 1;
     }
     atexit(SDL_Quit);
+    Uint32 reload = SDL_RegisterEvents(1);
 
     // Create an application window showing a piano image
     SDL_Window *window;
     SDL_Renderer *renderer;
         
-    if(SDL_CreateWindowAndRenderer(1296, 220, 0, &window, &renderer)) {
+    if(SDL_CreateWindowAndRenderer(WINDOW_W, WINDOW_H, 0, &window, &renderer)) {
         printf("Could not create window and renderer: %s\n", SDL_GetError());
         return 1;
     }
@@ -426,13 +509,9 @@ int main() {
         white_keys[i].x = i * 36;
         white_keys[i].y = 0;
         white_keys[i].w = 36;
-        white_keys[i].h = 220;
+        white_keys[i].h = WINDOW_H;
         keys.white[i].rect = &white_keys[i];
     }
-    SDL_SetRenderDrawColor(renderer, 0xff, 0xff, 0xff, 0xff);
-    SDL_RenderFillRects(renderer, white_keys, 36);
-    SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0xaa);
-    SDL_RenderDrawRects(renderer, white_keys, 36);
 
     SDL_Rect black_keys[25];
     int dist = 24;
@@ -446,185 +525,323 @@ int main() {
         }
         keys.black[i].rect = &black_keys[i];
     }
-    SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0xaa);
-    SDL_RenderFillRects(renderer, black_keys, 25);
-    SDL_SetRenderDrawColor(renderer, 0xff, 0xff, 0xff, 0xff);
-    SDL_RenderDrawRects(renderer, black_keys, 25);
 
-    SDL_RenderPresent(renderer);
+    static KeyMap map;
+    setupKeyMap(&map, &keys);
+
+    // paint at the rate of the display, 60 Hz if it does not say
+    static Screen screen;
+    SDL_DisplayMode mode;
+    screen.renderer = renderer;
+    screen.frame_ms = 1000 / 60;
+    int display = SDL_GetWindowDisplayIndex(window);
+    if (SDL_GetCurrentDisplayMode(display, &mode) == 0 &&
+            mode.refresh_rate > 0) {
+        screen.frame_ms = 1000 / mode.refresh_rate;
+    }
+    if (SDL_RenderTargetSupported(renderer)) {
+        screen.keyboard = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888,
+                SDL_TEXTUREACCESS_TARGET, WINDOW_W, WINDOW_H);
+    }
+    markAll(&screen, &keys);
 
     // setup audio
     SDL_AudioSpec want;
     SDL_AudioDeviceID dev;
+    Engine engine;
 
+    SDL_memset(&engine, 0, sizeof(engine));
     SDL_memset(&want, 0, sizeof(want));
     want.freq = 44100;
-    want.format = AUDIO_S8;
-    want.channels = 1;
-    want.samples = 1024;
+    want.format = AUDIO_F32SYS;
+    want.channels = 2;
+    want.samples = frames;
     want.callback = AudioCallback;
-    want.userdata = &keys;
-    dev = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    want.userdata = &engine;
+
+    // take whatever rate, format and layout the device runs at natively,
+    // the engine converts itself; only a format it cannot write is left
+    // to SDL's conversion
+    dev = SDL_OpenAudioDevice(NULL, 0, &want, &have,
+            SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_FORMAT_CHANGE |
+            SDL_AUDIO_ALLOW_CHANNELS_CHANGE);
+    if (dev != 0 && !canRender(&have)) {
+        SDL_CloseAudioDevice(dev);
+        dev = SDL_OpenAudioDevice(NULL, 0, &want, &have,
+                SDL_AUDIO_ALLOW_FREQUENCY_CHANGE |
+                SDL_AUDIO_ALLOW_CHANNELS_CHANGE);
+    }
 
     if (dev == 0) {
         SDL_Log("Failed to open audio: %s", SDL_GetError());
         return 1;
-    } 
+    }
+
+    SDL_Log("Audio: %d Hz, %d channels, %d bit %s, %d frames per buffer",
+            have.freq, have.channels, SDL_AUDIO_BITSIZE(have.format),
+            SDL_AUDIO_ISFLOAT(have.format) ? "float" : "int", have.samples);
+
+    // the device is still paused, so the callback cannot see a half-done engine
+    if (!setupEngine(&engine, &keys, &have)) {
+        SDL_Log("Failed to allocate audio buffers");
+        SDL_CloseAudioDevice(dev);
+        return 1;
+    }
+
+    // the recorder's ring and writer are there before the first buffer
+    if (out) {
+        engine.recorder = startRecorder(out, &have);
+        if (engine.recorder == NULL) {
+            SDL_Log("Could not record to %s: %s", out, SDL_GetError());
+            SDL_CloseAudioDevice(dev);
+            return 1;
+        }
+    }
 
-    if (have.format != want.format) { 
-        SDL_Log("We didn't get requested audio format.");
+    // the reverb's partitions are transformed before the first buffer too
+    if (ir) {
+        Reverb *reverb = loadReverb(ir, have.freq, engine.mix_len);
+        if (reverb == NULL || !addEffect(&engine.effects, &reverb->effect)) {
+            SDL_Log("Could not use %s as a reverb: %s", ir, SDL_GetError());
+            SDL_CloseAudioDevice(dev);
+            return 1;
+        }
+        SDL_Log("Reverb: %s, %d partitions of %d frames", ir, reverb->parts,
+                reverb->block);
+    }
+
+    // the song is parsed and timed for the device's rate before it starts
+    Song song;
+    if (midi) {
+        if (!loadSong(midi, &keys, have.freq, &song)) {
+            SDL_CloseAudioDevice(dev);
+            return 1;
+        }
+        SDL_Log("Playing %s: %d note events, %.1f s", midi, song.count,
+                (double)song.length / have.freq);
+        engine.song = &song;
+    }
+
+    // MIDI goes to the audio thread from a thread of its own
+    MidiInput *input = NULL;
+    if (midi_in) {
+        input = openMidi(midi_in, &engine);
+        if (input == NULL) {
+            SDL_Log("Could not read MIDI from %s: %s", midi_in,
+                    SDL_GetError());
+            SDL_CloseAudioDevice(dev);
+            return 1;
+        }
     }
 
     SDL_PauseAudioDevice(dev, 0); /* start audio playing. */
 
-    // setup event driven main loop
+    // the config is applied on this thread, where the watch sends its events
+    ConfigWatch *watch = NULL;
+    if (reload != (Uint32)-1) {
+        watch = watchConfig(ini, reload);
+    }
+
+    // setup event driven main loop, key presses go to the audio thread
+    // through the engine's event queue
     SDL_Event event;
     bool mousedown = false;
-    Key *mousePressed;
-    while (SDL_WaitEvent(&event)) {
-        int key = 0;
-        int mods = 0;
-        switch(event.type) {
-            case SDL_QUIT:
-                goto done;
-                break;
-            case SDL_MOUSEBUTTONDOWN:
-                if (event.button.button == SDL_BUTTON_LEFT) {
-                    mousedown = true;
-                    bool found = false;
-                    for (int i = 0; i < 25; i++) {
-                        if (isInside(keys.black[i].rect, &event.button)) {
-                            mousePressed = &keys.black[i];
-                            keys.black[i].on = true;
-                            found = true;
-                            break;
-                        }
-                    }
-                    if (found) {
-                        break; // don't look at white keys
+    bool dry = false;
+    Key *mousePressed = NULL;
+    bool overlay = false;
+    Uint32 drawn = 0;
+    for (;;) {
+        // paint when something changed and a display frame has passed
+        // since the last time, never more often
+        Uint32 now = SDL_GetTicks();
+        bool refresh = overlay && now - drawn >= OVERLAY_MS;
+        takeHeld(&screen, &keys, &engine);
+        if ((screen.count > 0 || screen.stale || refresh) &&
+                now - screen.painted >= screen.frame_ms) {
+            BufferStats stats;
+            paintKeys(&screen, &keys, &map);
+            if (overlay) {
+                if (latestBuffer(engine.log, &stats)) {
+                    drawOverlay(window, renderer, &stats,
+                            engine.voices.capacity);
+                }
+                drawn = now;
+            }
+            SDL_RenderPresent(renderer);
+            screen.painted = now;
+            screen.stale = false;
+        }
+
+        // then sleep until there is input, or until the next paint
+        Uint32 since = now - screen.painted;
+        int frame_left = since < screen.frame_ms ? screen.frame_ms - since : 0;
+        // a song or MIDI input can light keys without any input here, so
+        // the engine is looked at again after a display frame at most
+        int wait = screen.frame_ms;
+        if (screen.count > 0 || screen.stale) {
+            wait = frame_left;
+        }
+        if (overlay) {
+            int left = (int)(drawn + OVERLAY_MS - now);
+            left = left > frame_left ? left : frame_left;
+            wait = wait < left ? wait : left;
+        }
+        bool got = SDL_WaitEventTimeout(&event, wait);
+
+        // handle all the input there is before painting again
+        for (; got; got = SDL_PollEvent(&event)) {
+            int key = 0;
+            int mods = 0;
+            Key *k = NULL;
+            switch(event.type) {
+                case SDL_QUIT:
+                    goto done;
+                    break;
+                case SDL_WINDOWEVENT:
+                    if (event.window.event == SDL_WINDOWEVENT_EXPOSED) {
+                        screen.stale = true;
                     }
-                    for (int i = 0; i < 36; i++) {
-                        if (isInside(keys.white[i].rect, &event.button)) {
-                            mousePressed = &keys.white[i];
-                            keys.white[i].on = true;
-                            break;
+                    break;
+                case SDL_MOUSEBUTTONDOWN:
+                    if (event.button.button == SDL_BUTTON_LEFT) {
+                        mousedown = true;
+                        mousePressed = keyAt(&map, event.button.x,
+                                event.button.y);
+                        if (mousePressed) {
+                            playKey(&engine, &screen, mousePressed, true);
                         }
                     }
-                }
-                break;
-            case SDL_MOUSEBUTTONUP:
-                if (event.button.button == SDL_BUTTON_LEFT) {
-                    mousedown = false;
-                    mousePressed->on = false;
-                }
-                break;
-            case SDL_MOUSEMOTION:
-                if (mousedown) {
-                    bool found = false;
-                    for (int i = 0; i < 25; i++) {
-                        if (isInsideMotion(keys.black[i].rect, &event.motion) &&
-                                mousePressed != &keys.black[i]) {
-                            mousePressed->on = false;
-                            mousePressed = &keys.black[i];
-                            keys.black[i].on = true;
-                            found = true;
-                            break;
+                    break;
+                case SDL_MOUSEBUTTONUP:
+                    if (event.button.button == SDL_BUTTON_LEFT) {
+                        mousedown = false;
+                        if (mousePressed) {
+                            playKey(&engine, &screen, mousePressed, false);
+                            mousePressed = NULL;
                         }
                     }
-                    if (found) {
-                        break; // don't look at white keys
-                    }
-                    for (int i = 0; i < 36; i++) {
-                        if (isInsideMotion(keys.white[i].rect, &event.motion) &&
-                                mousePressed != &keys.white[i]) {
-                            mousePressed->on = false;
-                            mousePressed = &keys.white[i];
-                            keys.white[i].on = true;
-                            break;
+                    break;
+                case SDL_MOUSEMOTION:
+                    if (mousedown) {
+                        k = keyAt(&map, event.motion.x, event.motion.y);
+                        if (k && k != mousePressed) {
+                            if (mousePressed) {
+                                playKey(&engine, &screen, mousePressed, false);
+                            }
+                            mousePressed = k;
+                            playKey(&engine, &screen, k, true);
                         }
                     }
-                }
-                break;
-            case SDL_KEYDOWN:
-                if (event.key.repeat) {
                     break;
-                }
-                key = event.key.keysym.sym;
-                if (key == SDLK_ESCAPE) {
-                    goto done;
-                } else if (key == SDLK_F1) {
-                    wave = square;
-                } else if (key == SDLK_F2) {
-                    wave = triangle;
-                } else if (key == SDLK_F3) {
-                    wave = saw;
-                } else if (key == SDLK_F4) {
-                    wave = noise;
-                } else if (key == SDLK_F5) {
-                    wave = sine;
-                } else if (key == SDLK_F6) {
-                    wave = opl2_1;
-                } else if (key == SDLK_F7) {
-                    wave = opl2_2;
-                } else if (key == SDLK_F8) {
-                    wave = opl2_3;
-                } else if (key == SDLK_MINUS) {
-                    volume -= 1;
-                    if (volume < 1) {
-                        volume = 1;
-                    }
-                } else if (key == SDLK_EQUALS) {
-                    volume += 1;
-                    if (volume < 0) {
-                        volume = 127;
+                case SDL_KEYDOWN:
+                    if (event.key.repeat) {
+                        break;
                     }
-                } else if (key >= 0 && key <= 127) {
-                    mods = SDL_GetModState();
-                    if (mods & KMOD_SHIFT) {
-                        for (int i = 0; i < keys.b_len; i++) {
-                            if (keys.black[i].key == key) {
-                                keys.black[i].on = true;
-                                break;
-                            }
+                    key = event.key.keysym.sym;
+                    if (key == SDLK_ESCAPE) {
+                        goto done;
+                    } else if (key == SDLK_F1) {
+                        wave = square;
+                    } else if (key == SDLK_F2) {
+                        wave = triangle;
+                    } else if (key == SDLK_F3) {
+                        wave = saw;
+                    } else if (key == SDLK_F4) {
+                        wave = noise;
+                    } else if (key == SDLK_F5) {
+                        wave = sine;
+                    } else if (key == SDLK_F6) {
+                        wave = opl2_1;
+                    } else if (key == SDLK_F7) {
+                        wave = opl2_2;
+                    } else if (key == SDLK_F8) {
+                        wave = opl2_3;
+                    } else if (key == SDLK_F9) {
+                        dry = !dry;
+                        bypassEffects(&engine.effects, dry);
+                    } else if (key == SDLK_F12) {
+                        overlay = !overlay;
+                        screen.stale = true;
+                        if (!overlay) {
+                            SDL_SetWindowTitle(window, "");
                         }
-                    } else {
-                        for (int i = 0; i < keys.w_len; i++) {
-                            if (keys.white[i].key == key) {
-                                keys.white[i].on = true;
-                                break;
-                            }
+                    } else if (key == SDLK_LEFT && engine.song) {
+                        requestSeek(&song, songPosition(&song) - SEEK_SECONDS);
+                    } else if (key == SDLK_RIGHT && engine.song) {
+                        requestSeek(&song, songPosition(&song) + SEEK_SECONDS);
+                    } else if (key == SDLK_MINUS) {
+                        volume -= 1;
+                        if (volume < 1) {
+                            volume = 1;
                         }
-                    }
-                }
-                break;
-            case SDL_KEYUP:
-                key = event.key.keysym.sym;
-                if (key >= 0 && key <= 127) {
-                    mods = SDL_GetModState();
-                    if (mods & KMOD_SHIFT) {
-                        for (int i = 0; i < keys.b_len; i++) {
-                            if (keys.black[i].key == key) {
-                                keys.black[i].on = false;
-                                break;
-                            }
+                    } else if (key == SDLK_EQUALS) {
+                        volume += 1;
+                        if (volume < 0) {
+                            volume = 127;
                         }
                     } else {
-                        for (int i = 0; i < keys.w_len; i++) {
-                            if (keys.white[i].key == key) {
-                                keys.white[i].on = false;
-                                break;
-                            }
+                        mods = SDL_GetModState();
+                        k = keyForChar(&keys, key, mods & KMOD_SHIFT);
+                        if (k) {
+                            playKey(&engine, &screen, k, true);
                         }
                     }
-                }
-                break;
-            default:
-                break;
+                    if (key >= SDLK_F1 && key <= SDLK_F8 && wave_tables) {
+                        // until they are there the wave is rendered as usual
+                        buildWaveTables(&engine.tables, wave);
+                    }
+                    break;
+                case SDL_KEYUP:
+                    key = event.key.keysym.sym;
+                    mods = SDL_GetModState();
+                    k = keyForChar(&keys, key, mods & KMOD_SHIFT);
+                    if (k) {
+                        playKey(&engine, &screen, k, false);
+                    }
+                    break;
+                default:
+                    if (event.type == reload) {
+                        reloadConfig(ini, &defaults, &config, &keys, &engine,
+                                &screen, mousePressed);
+                    }
+                    break;
+            }
         }
     }
 
 done: // cleanup
+    stopWatching(watch);
+    if (input) {
+        int dropped = SDL_AtomicGet(&input->dropped);
+        if (dropped) {
+            SDL_Log("%d MIDI events dropped, the queue was full", dropped);
+        }
+        closeMidi(input);
+    }
     SDL_CloseAudioDevice(dev);
+    logLatency(&engine.latency); // the callback is done with it now
+    if (engine.recorder) {
+        Recorder *rec = engine.recorder;
+        double second = (double)have.freq * engine.frame_bytes;
+        if (!stopRecorder(rec)) {
+            SDL_Log("Could not write all of %s", out);
+        }
+        SDL_Log("Recorded %.1f s to %s, %d buffers (%.2f s) lost to overflow",
+                rec->wav.bytes / second, out,
+                SDL_AtomicGet(&rec->overflows), rec->lost / second);
+        freeRecorder(rec);
+        engine.recorder = NULL;
+    }
+    if (csv && !writeStatsCsv(engine.log, csv)) {
+        SDL_Log("Could not write %s", csv);
+    }
+    if (engine.song) {
+        freeSong(&song);
+    }
+    freeEngine(&engine);
+    if (screen.keyboard) {
+        SDL_DestroyTexture(screen.keyboard);
+    }
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
 
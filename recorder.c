@@ -0,0 +1,114 @@
+#include "recorder.h"
+
+/* Takes what the audio thread put in the ring and writes it out, at least
+ * RECORD_CHUNK bytes at a time (as much as is there up to the end of the
+ * ring) unless the recording is ending. A failed write still frees the
+ * ring, so the audio thread does not back up behind it.
+ */
+static int writerMain(void *arg) {
+    Recorder *rec = arg;
+    Uint32 tail = (Uint32)SDL_AtomicGet(&rec->tail);
+
+    for (;;) {
+        // quit first: whatever was put in before it was set gets written
+        bool quit = SDL_AtomicGet(&rec->quit);
+        Uint32 head = (Uint32)SDL_AtomicGet(&rec->head);
+        SDL_MemoryBarrierAcquire(); // see the bytes the moved head points past
+        Uint32 ready = head - tail;
+        if (ready == 0 && quit) {
+            return 0;
+        }
+        if (ready < RECORD_CHUNK && !quit) {
+            SDL_Delay(RECORD_POLL_MS);
+            continue;
+        }
+
+        Uint32 at = tail & (RECORD_RING - 1);
+        Uint32 len = ready < RECORD_RING - at ? ready : RECORD_RING - at;
+        if (!rec->failed && !writeWav(&rec->wav, rec->ring + at, len)) {
+            SDL_Log("Recording stopped: %s", SDL_GetError());
+            rec->failed = true;
+        }
+        tail += len;
+        SDL_MemoryBarrierRelease(); // done reading before handing it back
+        SDL_AtomicSet(&rec->tail, (int)tail);
+    }
+}
+
+/* Creates path, a .wav file or, if the name ends in .raw, bare samples, and
+ * starts the writer. Returns NULL if that fails, the reason is in
+ * SDL_GetError().
+ */
+Recorder *startRecorder(const char *path, SDL_AudioSpec *spec) {
+    Recorder *rec = SDL_malloc(sizeof(Recorder));
+    if (rec == NULL) {
+        SDL_OutOfMemory();
+        return NULL;
+    }
+    SDL_memset(rec, 0, sizeof(*rec));
+    size_t len = SDL_strlen(path);
+    bool raw = len >= 4 && SDL_strcmp(path + len - 4, ".raw") == 0;
+
+    rec->ring = SDL_malloc(RECORD_RING);
+    if (rec->ring == NULL) {
+        SDL_OutOfMemory();
+        SDL_free(rec);
+        return NULL;
+    }
+    if (raw ? !openRaw(&rec->wav, path) : !openWav(&rec->wav, path, spec)) {
+        SDL_free(rec->ring);
+        SDL_free(rec);
+        return NULL;
+    }
+    rec->thread = SDL_CreateThread(writerMain, "recorder", rec);
+    if (rec->thread == NULL) {
+        closeWav(&rec->wav);
+        SDL_free(rec->ring);
+        SDL_free(rec);
+        return NULL;
+    }
+    return rec;
+}
+
+/* Copies a buffer the audio thread has rendered into the ring, or counts it
+ * as lost if it does not fit. Costs one or two memcpy of len bytes, no more,
+ * however the writer is doing.
+ */
+void recordAudio(Recorder *rec, const Uint8 *stream, int len) {
+    Uint32 head = (Uint32)SDL_AtomicGet(&rec->head);
+    Uint32 tail = (Uint32)SDL_AtomicGet(&rec->tail);
+    if ((Uint32)len > RECORD_RING - (head - tail)) {
+        SDL_AtomicAdd(&rec->overflows, 1);
+        rec->lost += len;
+        return;
+    }
+    SDL_MemoryBarrierAcquire(); // the writer is done with the space it freed
+
+    Uint32 at = head & (RECORD_RING - 1);
+    Uint32 first = (Uint32)len < RECORD_RING - at ? (Uint32)len :
+        RECORD_RING - at;
+    SDL_memcpy(rec->ring + at, stream, first);
+    SDL_memcpy(rec->ring, stream + first, len - first);
+    SDL_MemoryBarrierRelease(); // the bytes must be there before the head moves
+    SDL_AtomicSet(&rec->head, (int)(head + len));
+}
+
+/* Has the writer write out what is left, then finishes the file. Only once
+ * the audio thread has stopped recording. Returns false if anything could
+ * not be written.
+ */
+bool stopRecorder(Recorder *rec) {
+    SDL_AtomicSet(&rec->quit, 1);
+    SDL_WaitThread(rec->thread, NULL);
+    rec->thread = NULL;
+    return closeWav(&rec->wav) && !rec->failed;
+}
+
+/* Frees a stopped recorder, NULL is fine
+ */
+void freeRecorder(Recorder *rec) {
+    if (rec) {
+        SDL_free(rec->ring);
+        SDL_free(rec);
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+#include "wav.h"
+
+#define RECORD_RING (1 << 22)  // bytes, a power of 2: some 12 s of 44.1 kHz
+                               // stereo float
+#define RECORD_CHUNK (1 << 16) // the writer waits for this much at least
+#define RECORD_POLL_MS 10      // and looks that often
+
+/* Records what the audio thread plays to a file without it ever touching
+ * the file. The audio thread copies every buffer into a ring that was
+ * allocated up front and moves the head on, a thread of the recorder's own
+ * takes what is there in large pieces, writes them out and moves the tail.
+ * Both are byte counts that only grow (and wrap at 2^32, which the ring
+ * size divides), so head - tail is what is waiting. Neither side locks,
+ * and the audio thread makes no system calls: the writer does not get
+ * woken up but looks every RECORD_POLL_MS.
+ *
+ * When the writer falls so far behind that a buffer does not fit, the
+ * buffer is left out of the recording and counted.
+ */
+typedef struct Recorder {
+    Uint8 *ring;        // RECORD_RING bytes
+    SDL_atomic_t head;  // bytes put in, only moved by the audio thread
+    SDL_atomic_t tail;  // bytes written out, only moved by the writer
+    SDL_atomic_t overflows; // buffers that did not fit
+    Uint64 lost;        // and their bytes, audio thread only
+    SDL_atomic_t quit;  // set by stopRecorder, the writer drains the ring
+    WavWriter wav;
+    SDL_Thread *thread;
+    bool failed;        // a write went wrong, writer only until it stops
+} Recorder;
+
+Recorder *startRecorder(const char *path, SDL_AudioSpec *spec);
+void recordAudio(Recorder *rec, const Uint8 *stream, int len);
+bool stopRecorder(Recorder *rec);
+void freeRecorder(Recorder *rec);
+
+#endif
@@ -0,0 +1,403 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <SDL2/SDL.h>
+#include "config.h"
+#include "dsp.h"
+#include "reverb.h"
+#include "synth.h"
+#include "wav.h"
+
+#define SONG_TAIL 10 // seconds a song may ring on after its last event
+
+/* Offline renderer: plays a script of timed note events through the same
+ * engine the audio callback uses, as fast as the CPU allows, and writes the
+ * result to a .wav file. No window or audio device needed, so it runs on a
+ * headless box and doubles as a throughput benchmark.
+ *
+ * A script has one event per line, '#' starts a comment unless it is part
+ * of a black key's name:
+ *
+ *     # seconds  command  argument
+ *     0.0        on       C4
+ *     0.0        on       C4#      # a black key
+ *     0.0        wave     sine
+ *     0.5        off      C4
+ *     1.5        volume   20
+ *     2.0        end
+ *
+ * Rendering stops at the 'end' event, or else at the last event. With -i
+ * the tuning, wave form and volume of a config file (see config.c) apply
+ * from the start.
+ *
+ * Instead of a script it also plays a Standard MIDI File (.mid or .midi,
+ * see song.c), from the start or from -a seconds on, until the last note
+ * has died away.
+ *
+ * The noise is seeded with 1 unless -S says otherwise, so the same script
+ * always renders to the same file. With more than one thread (-j) only if
+ * they share the voices out deterministically (-d): otherwise the voices
+ * get added up in a different order every time, and the last bits of the
+ * samples differ.
+ */
+
+typedef enum Command {
+    note_on,
+    note_off,
+    set_wave,
+    set_volume,
+    end
+} Command;
+
+typedef struct ScriptEvent {
+    Uint64 frame;   // sample at which it happens
+    int line;       // keeps events at the same time in script order
+    Command cmd;
+    Key *key;       // for note_on and note_off
+    int value;      // wave form or volume
+} ScriptEvent;
+
+static int compareEvents(const void *a, const void *b) {
+    const ScriptEvent *x = a;
+    const ScriptEvent *y = b;
+    if (x->frame != y->frame) {
+        return x->frame < y->frame ? -1 : 1;
+    }
+    return x->line - y->line;
+}
+
+/* Reads the script at path into a newly allocated, time sorted array.
+ * Returns the number of events, or -1 on error.
+ */
+static int readScript(const char *path, Keys *keys, int rate,
+        ScriptEvent **events) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        printf("Could not open %s\n", path);
+        return -1;
+    }
+
+    int count = 0;
+    int size = 0;
+    char line[256];
+    *events = NULL;
+    for (int n = 1; fgets(line, sizeof(line), f); n++) {
+        double time;
+        char cmd[16];
+        char arg[16] = "";
+        // a comment starts at a '#' at the start of a line or after a
+        // blank, the one in black key names like C4# does not count
+        for (char *c = line; *c; c++) {
+            if (*c == '#' && (c == line || SDL_isspace((unsigned char)c[-1]))) {
+                *c = 0;
+                break;
+            }
+        }
+        int fields = sscanf(line, "%lf %15s %15s", &time, cmd, arg);
+        if (fields <= 0) {
+            continue; // empty line
+        }
+
+        ScriptEvent ev;
+        SDL_memset(&ev, 0, sizeof(ev));
+        ev.frame = (Uint64)(time * rate + 0.5);
+        ev.line = n;
+        bool ok = fields >= 2 && time >= 0;
+        if (!ok) {
+            // fall through to the error below
+        } else if (SDL_strcmp(cmd, "on") == 0 || SDL_strcmp(cmd, "off") == 0) {
+            ev.cmd = cmd[1] == 'n' ? note_on : note_off;
+            ev.key = findKey(keys, arg);
+            ok = ev.key != NULL;
+        } else if (SDL_strcmp(cmd, "wave") == 0) {
+            WaveForm w;
+            ev.cmd = set_wave;
+            ok = parseWave(arg, &w);
+            ev.value = w;
+        } else if (SDL_strcmp(cmd, "volume") == 0) {
+            ev.cmd = set_volume;
+            ev.value = SDL_atoi(arg);
+            ok = ev.value >= 1 && ev.value <= 127;
+        } else if (SDL_strcmp(cmd, "end") == 0) {
+            ev.cmd = end;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            printf("%s:%d: cannot make sense of this line\n", path, n);
+            SDL_free(*events);
+            fclose(f);
+            return -1;
+        }
+
+        if (count == size) {
+            size = size ? size * 2 : 64;
+            ScriptEvent *more = SDL_realloc(*events,
+                    sizeof(ScriptEvent) * size);
+            if (more == NULL) {
+                printf("Out of memory reading %s\n", path);
+                SDL_free(*events);
+                fclose(f);
+                return -1;
+            }
+            *events = more;
+        }
+        (*events)[count++] = ev;
+    }
+    fclose(f);
+
+    SDL_qsort(*events, count, sizeof(ScriptEvent), compareEvents);
+    return count;
+}
+
+/* Renders the song the engine plays into wav, buffer by buffer, until it
+ * is over and nothing sounds any more, or for SONG_TAIL seconds more at
+ * most. Adds what it did to frame and ticks. Returns false if the file could
+ * not be written.
+ */
+static bool renderSong(Engine *engine, Uint8 *buffer, WavWriter *wav,
+        Uint64 *frame, Uint64 *ticks) {
+    Song *song = engine->song;
+    int samples = engine->spec.samples;
+    int bytes = SDL_AUDIO_BITSIZE(engine->spec.format) / 8 *
+        engine->spec.channels;
+    Uint64 stop = song->length + (Uint64)SONG_TAIL * song->rate;
+    bool ok = true;
+    while (ok) {
+        // the first buffer takes a seek asked for with -a
+        bool seeking = SDL_AtomicGet(&song->seek) != 0;
+        bool playing = song->next < song->count || engine->voices.active > 0;
+        if (!seeking && (!playing || song->frame >= stop)) {
+            break;
+        }
+        Uint64 start = SDL_GetPerformanceCounter();
+        renderAudio(engine, buffer, samples * bytes);
+        *ticks += SDL_GetPerformanceCounter() - start;
+        ok = writeWav(wav, buffer, samples * bytes);
+        *frame += samples;
+    }
+    return ok;
+}
+
+static bool isSong(const char *path) {
+    size_t len = SDL_strlen(path);
+    return (len >= 4 && SDL_strcasecmp(path + len - 4, ".mid") == 0) ||
+        (len >= 5 && SDL_strcasecmp(path + len - 5, ".midi") == 0);
+}
+
+static void usage() {
+    printf("usage: piano-render [-r rate] [-b buffer] [-p polyphony] "
+            "[-c channels] [-n] [-t]\n"
+            "                    [-j threads] [-d] [-f s16|s32|f32] "
+            "[-s stats.csv] [-S seed]\n"
+            "                    [-i config.ini] [-a seconds] [-R ir.wav] "
+            "script.txt|song.mid out.wav\n");
+}
+
+int main(int argc, char *argv[]) {
+    SDL_AudioSpec spec;
+    SDL_memset(&spec, 0, sizeof(spec));
+    spec.freq = 44100;
+    spec.format = AUDIO_S16SYS;
+    spec.channels = 1;
+    spec.samples = 1024;
+
+    int frames = spec.samples;
+    const char *csv = NULL;
+    const char *ini = NULL;
+    const char *ir = NULL;
+    double at = 0;
+    bool seek = false;
+    int arg = 1;
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+        const char *val = argv[arg + 1];
+        // the first three take no value
+        if (SDL_strcmp(argv[arg], "-n") == 0) {
+            band_limited = false;
+            arg--;
+        } else if (SDL_strcmp(argv[arg], "-d") == 0) {
+            deterministic = true;
+            arg--;
+        } else if (SDL_strcmp(argv[arg], "-t") == 0) {
+            wave_tables = true;
+            arg--;
+        } else if (SDL_strcmp(argv[arg], "-r") == 0) {
+            spec.freq = SDL_atoi(val);
+        } else if (SDL_strcmp(argv[arg], "-b") == 0) {
+            frames = SDL_atoi(val);
+        } else if (SDL_strcmp(argv[arg], "-c") == 0) {
+            spec.channels = SDL_atoi(val);
+        } else if (SDL_strcmp(argv[arg], "-s") == 0) {
+            csv = val;
+        } else if (SDL_strcmp(argv[arg], "-i") == 0) {
+            ini = val;
+        } else if (SDL_strcmp(argv[arg], "-a") == 0) {
+            at = SDL_strtod(val, NULL);
+            seek = true;
+        } else if (SDL_strcmp(argv[arg], "-R") == 0) {
+            ir = val;
+        } else if (SDL_strcmp(argv[arg], "-S") == 0) {
+            noise_seed = SDL_strtoul(val, NULL, 0);
+        } else if (SDL_strcmp(argv[arg], "-p") == 0) {
+            polyphony = SDL_atoi(val);
+        } else if (SDL_strcmp(argv[arg], "-j") == 0) {
+            render_threads = SDL_atoi(val);
+        } else if (SDL_strcmp(argv[arg], "-f") == 0 &&
+                SDL_strcmp(val, "s16") == 0) {
+            spec.format = AUDIO_S16SYS;
+        } else if (SDL_strcmp(argv[arg], "-f") == 0 &&
+                SDL_strcmp(val, "s32") == 0) {
+            spec.format = AUDIO_S32SYS;
+        } else if (SDL_strcmp(argv[arg], "-f") == 0 &&
+                SDL_strcmp(val, "f32") == 0) {
+            spec.format = AUDIO_F32SYS;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (frames < MIN_FRAMES || frames > MAX_FRAMES) {
+        printf("-b takes %d to %d frames\n", MIN_FRAMES, MAX_FRAMES);
+        return 1;
+    }
+    spec.samples = frames;
+    if (argc - arg != 2 || spec.freq <= 0 ||
+            spec.channels < 1 || spec.channels > 8 ||
+            polyphony < 1 || polyphony > NOTES ||
+            render_threads < 1 || render_threads > MAX_THREADS) {
+        usage();
+        return 1;
+    }
+    if (seek && at < 0) {
+        printf("-a takes the seconds to start at, not %g\n", at);
+        return 1;
+    }
+    if (seek && !isSong(argv[arg])) {
+        printf("-a only works with a .mid file, a script has no seeking\n");
+        return 1;
+    }
+
+    // the same keyboard as the interactive piano
+    Key white[36];
+    Key black[25];
+    Keys keys;
+    keys.white = white;
+    keys.w_len = 36;
+    keys.black = black;
+    keys.b_len = 25;
+    setupKeys(&keys, 'C', 2, 'C', 7);
+    setupKernels();
+
+    Config config;
+    defaultConfig(&config);
+    if (ini && !readConfig(ini, &keys, &config)) {
+        return 1;
+    }
+    applyConfig(&config, NULL, &keys, NULL);
+
+    ScriptEvent *events = NULL;
+    int count = 0;
+    Song song;
+    bool midi = isSong(argv[arg]);
+    if (midi) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        if (!loadSong(argv[arg], &keys, spec.freq, &song)) {
+            return 1;
+        }
+        printf("loaded %d note events, %.1f s, in %.2f ms\n", song.count,
+                (double)song.length / spec.freq,
+                (SDL_GetPerformanceCounter() - start) * 1000.0 /
+                SDL_GetPerformanceFrequency());
+        if (seek) {
+            requestSeek(&song, at);
+        }
+    } else {
+        count = readScript(argv[arg], &keys, spec.freq, &events);
+        if (count < 0) {
+            return 1;
+        }
+    }
+
+    Engine engine;
+    WavWriter wav;
+    int bytes = SDL_AUDIO_BITSIZE(spec.format) / 8 * spec.channels;
+    Uint8 *buffer = SDL_malloc(spec.samples * bytes);
+    if (!setupEngine(&engine, &keys, &spec) || buffer == NULL) {
+        printf("Failed to allocate audio buffers\n");
+        return 1;
+    }
+    if (ir) {
+        Reverb *reverb = loadReverb(ir, spec.freq, engine.mix_len);
+        if (reverb == NULL || !addEffect(&engine.effects, &reverb->effect)) {
+            printf("Could not use %s as a reverb: %s\n", ir, SDL_GetError());
+            return 1;
+        }
+    }
+    if (!openWav(&wav, argv[arg + 1], &spec)) {
+        printf("Could not write %s: %s\n", argv[arg + 1], SDL_GetError());
+        return 1;
+    }
+    if (midi) {
+        engine.song = &song;
+    }
+
+    // render up to each event, then apply it: that makes every event
+    // sample accurate, whatever the buffer size (the queue renderAudio
+    // reads from stays empty, it is for events from another thread)
+    Uint64 frame = 0;
+    Uint64 ticks = 0;
+    bool ok = !midi || renderSong(&engine, buffer, &wav, &frame, &ticks);
+    for (int e = 0; e < count && ok; e++) {
+        while (frame < events[e].frame && ok) {
+            Uint64 left = events[e].frame - frame;
+            int len = left < spec.samples ? (int)left : spec.samples;
+            Uint64 start = SDL_GetPerformanceCounter();
+            renderAudio(&engine, buffer, len * bytes);
+            ticks += SDL_GetPerformanceCounter() - start;
+            ok = writeWav(&wav, buffer, len * bytes);
+            frame += len;
+        }
+
+        if (events[e].cmd == note_on || events[e].cmd == note_off) {
+            NoteEvent ev;
+            ev.time = 0;
+            ev.key = events[e].key;
+            ev.on = events[e].cmd == note_on;
+            ev.velocity = FULL_VELOCITY;
+            applyEvent(&engine, &ev);
+        } else if (events[e].cmd == set_wave) {
+            wave = events[e].value;
+            takeWave(&engine); // for notes that start before the next buffer
+            if (wave_tables) {
+                buildWaveTables(&engine.tables, wave);
+            }
+        } else if (events[e].cmd == set_volume) {
+            volume = events[e].value;
+        } else { // end
+            break;
+        }
+    }
+    if (!closeWav(&wav) || !ok) {
+        printf("Could not write %s: %s\n", argv[arg + 1], SDL_GetError());
+        return 1;
+    }
+
+    double seconds = (double)frame / spec.freq;
+    double took = (double)ticks / SDL_GetPerformanceFrequency();
+    printf("rendered %.2f s of audio in %.2f ms (%.1fx real time, %s kernels, "
+            "%d thread%s)\n", seconds, took * 1000,
+            took > 0 ? seconds / took : 0, dsp->name, render_threads,
+            render_threads > 1 ? "s" : "");
+
+    if (csv && !writeStatsCsv(engine.log, csv)) {
+        printf("Could not write %s\n", csv);
+        return 1;
+    }
+
+    if (midi) {
+        freeSong(&song);
+    }
+    SDL_free(events);
+    SDL_free(buffer);
+    freeEngine(&engine);
+    return 0;
+}
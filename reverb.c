@@ -0,0 +1,186 @@
+#include <math.h>
+#include "dsp.h"
+#include "reverb.h"
+
+/* One block: the window of the last two blocks of input goes into history
+ * as a spectrum, every spectrum in history is multiplied by the partition
+ * of the impulse response as many blocks back and added up, and the second
+ * half of the inverse transform of that is the next block of output. The
+ * first half is wrapped around and thrown away.
+ */
+static void convolveBlock(Reverb *r) {
+    int block = r->block;
+    float *sum_re = r->sum;
+    float *sum_im = r->sum + r->stride;
+    r->newest = r->newest + 1 < r->parts ? r->newest + 1 : 0;
+    float *x = r->history + (size_t)r->newest * 2 * r->stride;
+    forwardFft(&r->fft, r->window, x, x + r->stride);
+
+    SDL_memset(r->sum, 0, sizeof(float) * 2 * r->stride);
+    int slot = r->newest;
+    for (int p = 0; p < r->parts; p++) {
+        const float *h = r->ir + (size_t)p * 2 * r->stride;
+        x = r->history + (size_t)slot * 2 * r->stride;
+        dsp->multiplyAdd(sum_re, sum_im, x, x + r->stride, h, h + r->stride,
+                r->bins);
+        slot = slot > 0 ? slot - 1 : r->parts - 1;
+    }
+    inverseFft(&r->fft, sum_re, sum_im, r->out);
+    SDL_memcpy(r->window, r->window + block, sizeof(float) * block);
+}
+
+/* Adds the reverb to len samples, and takes them in for a later block
+ */
+static void processReverb(Effect *fx, float *audio, int len) {
+    Reverb *r = (Reverb*)fx;
+    int block = r->block;
+    while (len > 0) {
+        int n = block - r->fill < len ? block - r->fill : len;
+        SDL_memcpy(r->window + block + r->fill, audio, sizeof(float) * n);
+        dsp->add(audio, r->out + block + r->fill, n);
+        r->fill += n;
+        audio += n;
+        len -= n;
+        if (r->fill == block) {
+            convolveBlock(r);
+            r->fill = 0;
+        }
+    }
+}
+
+static void clearReverb(Effect *fx) {
+    Reverb *r = (Reverb*)fx;
+    SDL_memset(r->history, 0, sizeof(float) * 2 * r->stride * r->parts);
+    SDL_memset(r->window, 0, sizeof(float) * 2 * r->block);
+    SDL_memset(r->out, 0, sizeof(float) * 2 * r->block);
+    r->newest = 0;
+    r->fill = 0;
+}
+
+static void destroyReverb(Effect *fx) {
+    Reverb *r = (Reverb*)fx;
+    freeFft(&r->fft);
+    SDL_free(r->ir);
+    SDL_free(r->history);
+    SDL_free(r->sum);
+    SDL_free(r->window);
+    SDL_free(r->out);
+    SDL_free(r);
+}
+
+/* A reverb with the impulse response ir, len samples at the rate of the
+ * mix and already at the level it is to be added at, for buffers of frames
+ * frames. Returns NULL if the buffers are under REVERB_MIN_BLOCK frames or
+ * memory could not be had, the reason is in SDL_GetError().
+ */
+Reverb *newReverb(const float *ir, int len, int frames) {
+    if (frames < REVERB_MIN_BLOCK) {
+        SDL_SetError("the reverb needs buffers of at least %d frames",
+                REVERB_MIN_BLOCK);
+        return NULL;
+    }
+    Reverb *r = SDL_calloc(1, sizeof(Reverb));
+    if (r == NULL) {
+        SDL_OutOfMemory();
+        return NULL;
+    }
+    r->effect.name = "reverb";
+    r->effect.process = processReverb;
+    r->effect.clear = clearReverb;
+    r->effect.destroy = destroyReverb;
+    r->block = REVERB_MIN_BLOCK;
+    while (r->block * 2 <= frames) {
+        r->block *= 2;
+    }
+    r->parts = len > 0 ? (len + r->block - 1) / r->block : 1;
+    r->bins = r->block + 1;
+    r->stride = (r->bins + 7) & ~7; // every spectrum 32 byte aligned
+    // the output of a block is there a block later, and the last samples
+    // of input may not have filled theirs
+    r->effect.tail = (r->parts + 3) * r->block;
+
+    size_t spectra = sizeof(float) * 2 * r->stride * r->parts;
+    r->ir = SDL_malloc(spectra);
+    r->history = SDL_malloc(spectra);
+    r->sum = SDL_malloc(sizeof(float) * 2 * r->stride);
+    r->window = SDL_malloc(sizeof(float) * 2 * r->block);
+    r->out = SDL_malloc(sizeof(float) * 2 * r->block);
+    if (!setupFft(&r->fft, 2 * r->block) || r->ir == NULL ||
+            r->history == NULL || r->sum == NULL || r->window == NULL ||
+            r->out == NULL) {
+        SDL_OutOfMemory();
+        destroyReverb(&r->effect);
+        return NULL;
+    }
+
+    // the partitions padded with a block of silence, which keeps the
+    // convolution from wrapping around into the half that is used; the
+    // 1 / n the inverse FFT leaves out is put in here
+    float scale = 1.0f / r->fft.n;
+    for (int p = 0; p < r->parts; p++) {
+        float *h = r->ir + (size_t)p * 2 * r->stride;
+        for (int i = 0; i < 2 * r->block; i++) {
+            int at = p * r->block + i;
+            r->window[i] = i < r->block && at < len ? ir[at] * scale : 0;
+        }
+        forwardFft(&r->fft, r->window, h, h + r->stride);
+    }
+    clearReverb(&r->effect);
+    return r;
+}
+
+/* Reads an impulse response from a .wav file, in any format SDL reads,
+ * brings it to the rate of the mix and to one channel, and makes it into
+ * a reverb for buffers of frames frames. The response is scaled to unit
+ * energy, so that the reverb is about as loud as the mix, and then to
+ * REVERB_LEVEL. Returns NULL if that cannot be done, the reason is in
+ * SDL_GetError().
+ */
+Reverb *loadReverb(const char *path, int rate, int frames) {
+    SDL_AudioSpec spec;
+    Uint8 *data;
+    Uint32 bytes;
+    if (SDL_LoadWAV(path, &spec, &data, &bytes) == NULL) {
+        return NULL;
+    }
+    SDL_AudioCVT cvt;
+    if (SDL_BuildAudioCVT(&cvt, spec.format, spec.channels, spec.freq,
+                AUDIO_F32SYS, 1, rate) < 0) {
+        SDL_FreeWAV(data);
+        return NULL;
+    }
+    cvt.len = bytes;
+    cvt.buf = SDL_malloc((size_t)bytes * cvt.len_mult);
+    if (cvt.buf == NULL) {
+        SDL_FreeWAV(data);
+        SDL_OutOfMemory();
+        return NULL;
+    }
+    SDL_memcpy(cvt.buf, data, bytes);
+    SDL_FreeWAV(data);
+    if (SDL_ConvertAudio(&cvt) < 0) {
+        SDL_free(cvt.buf);
+        return NULL;
+    }
+
+    float *ir = (float*)cvt.buf;
+    int len = cvt.len_cvt / sizeof(float);
+    double energy = 0;
+    for (int i = 0; i < len; i++) {
+        energy += ir[i] * ir[i];
+    }
+    Reverb *r = NULL;
+    if (len > REVERB_MAX_SECONDS * rate) {
+        SDL_SetError("%s is longer than %d s", path, REVERB_MAX_SECONDS);
+    } else if (energy == 0) {
+        SDL_SetError("%s is silent", path);
+    } else {
+        float gain = (float)(REVERB_LEVEL / sqrt(energy));
+        for (int i = 0; i < len; i++) {
+            ir[i] *= gain;
+        }
+        r = newReverb(ir, len, frames);
+    }
+    SDL_free(cvt.buf);
+    return r;
+}
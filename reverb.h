@@ -0,0 +1,43 @@
+#ifndef REVERB_H
+#define REVERB_H
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+#include "effects.h"
+#include "fft.h"
+
+#define REVERB_LEVEL 0.3f       // of the reverb against the dry mix, -10 dB
+#define REVERB_MAX_SECONDS 10   // longest impulse response that is taken
+#define REVERB_MIN_BLOCK 16     // frames, no smaller buffers are taken
+
+/* Convolution reverb: the mix convolved with the recorded impulse response
+ * of a room, added to the mix. The response is cut into partitions of one
+ * block each, and every block of input is convolved with all of them in
+ * the frequency domain (uniformly partitioned overlap-save): one forward
+ * and one inverse FFT per block, and per partition one multiply-add of
+ * spectra, which dsp does with the vector units. The reverb comes out one
+ * block late; the block is the buffer rounded down to a power of 2, so the
+ * delay is never longer than a buffer. Buffers under REVERB_MIN_BLOCK frames
+ * are not taken, blocks that small would cost far too many transforms.
+ */
+typedef struct Reverb {
+    Effect effect;  // first, see Effect
+    Fft fft;        // of two blocks
+    int block;      // samples, a power of 2
+    int parts;      // partitions of the impulse response
+    int bins;       // in a spectrum, block + 1
+    int stride;     // floats from one spectrum to the next, real parts
+                    // then imaginary ones
+    float *ir;      // spectrum of every partition
+    float *history; // of the last parts blocks of input, a ring
+    int newest;     // slot of the last block in history
+    float *sum;     // the spectrum of the output, being added up
+    float *window;  // the last block of input and the one coming in
+    float *out;     // the last inverse FFT, its second half is the output
+    int fill;       // samples of the block coming in so far
+} Reverb;
+
+Reverb *newReverb(const float *ir, int len, int frames);
+Reverb *loadReverb(const char *path, int rate, int frames);
+
+#endif
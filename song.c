@@ -0,0 +1,398 @@
+#include <stdio.h>
+#include "song.h"
+#include "synth.h"
+
+/* Standard MIDI Files, format 0 (one track) and 1 (tracks played together).
+ * Everything but the notes and the tempo is skipped, and so are the notes
+ * of channel 10, the drum kit. Notes off the keyboard are moved by whole
+ * octaves onto it.
+ *
+ * Loading turns the delta times of every track into absolute ticks, sorts
+ * the events of all tracks together and works out the sample every event
+ * falls on from the tempo changes before it, once. Playing is then a walk
+ * along the array.
+ *
+ * To seek, the index keeps the set of notes that are held at every
+ * SONG_MARK-th event. The event at a point in time is found by a binary
+ * search, and the held notes from the mark before it and at most SONG_MARK
+ * events after the mark, whatever the length of the song.
+ */
+
+#define DRUMS 9             // channel of the drum kit, counted from 0
+#define DEFAULT_TEMPO 500000 // microseconds per quarter note, 120 bpm
+
+enum { raw_tempo, raw_off, raw_on };
+
+// an event of the file, before it has a time in samples
+typedef struct RawEvent {
+    Uint32 tick;    // from the start of its track
+    Uint32 order;   // position in the file, which events at the same tick
+                    // keep: a note may end and start again at one tick
+    Uint8 kind;
+    Uint8 channel;
+    Uint8 note;
+    Uint8 velocity; // for raw_on
+    Uint32 tempo;   // microseconds per quarter note, for raw_tempo
+} RawEvent;
+
+typedef struct RawEvents {
+    RawEvent *events;
+    int count;
+    int size;
+} RawEvents;
+
+// the bytes of the file that are left to parse
+typedef struct Reader {
+    const Uint8 *at;
+    const Uint8 *end;
+    bool bad;       // went past the end
+} Reader;
+
+static Uint32 readByte(Reader *r) {
+    if (r->at >= r->end) {
+        r->bad = true;
+        return 0;
+    }
+    return *r->at++;
+}
+
+// a big endian number of n bytes
+static Uint32 readNumber(Reader *r, int n) {
+    Uint32 x = 0;
+    for (int i = 0; i < n; i++) {
+        x = x << 8 | readByte(r);
+    }
+    return x;
+}
+
+// a number of 7 bits per byte, all but the last with the top bit set
+static Uint32 readVarLen(Reader *r) {
+    Uint32 x = 0;
+    for (int i = 0; i < 4; i++) {
+        Uint32 b = readByte(r);
+        x = x << 7 | (b & 0x7f);
+        if (!(b & 0x80)) {
+            return x;
+        }
+    }
+    r->bad = true;
+    return 0;
+}
+
+static void skip(Reader *r, Uint32 len) {
+    if (len > (Uint32)(r->end - r->at)) {
+        r->bad = true;
+        r->at = r->end;
+    } else {
+        r->at += len;
+    }
+}
+
+static bool addRaw(RawEvents *raw, const RawEvent *ev) {
+    if (raw->count == raw->size) {
+        int size = raw->size ? raw->size * 2 : 4096;
+        RawEvent *more = SDL_realloc(raw->events, sizeof(RawEvent) * size);
+        if (more == NULL) {
+            return false;
+        }
+        raw->events = more;
+        raw->size = size;
+    }
+    raw->events[raw->count++] = *ev;
+    return true;
+}
+
+/* Adds the notes and tempo changes of one track to raw. Returns false if
+ * the track is broken or memory ran out.
+ */
+static bool readTrack(Reader *r, RawEvents *raw) {
+    RawEvent ev;
+    int status = 0; // of the last channel message, for running status
+    ev.tick = 0;
+    ev.tempo = 0;
+    while (r->at < r->end && !r->bad) {
+        ev.tick += readVarLen(r);
+        ev.order = raw->count;
+        Uint32 b = readByte(r);
+        if (b == 0xff) { // meta event
+            Uint32 type = readByte(r);
+            Uint32 len = readVarLen(r);
+            status = 0;
+            if (type == 0x2f) {
+                return !r->bad; // end of track
+            }
+            if (type == 0x51 && len == 3) {
+                ev.kind = raw_tempo;
+                ev.channel = 0;
+                ev.note = 0;
+                ev.velocity = 0;
+                ev.tempo = readNumber(r, 3);
+                if (ev.tempo == 0 || !addRaw(raw, &ev)) {
+                    return false;
+                }
+            } else {
+                skip(r, len);
+            }
+            continue;
+        }
+        if (b == 0xf0 || b == 0xf7) { // system exclusive
+            skip(r, readVarLen(r));
+            status = 0;
+            continue;
+        }
+
+        Uint32 data;
+        if (b & 0x80) {
+            status = b;
+            data = readByte(r);
+        } else if (status) {
+            data = b; // running status: same kind of message as before
+        } else {
+            return false;
+        }
+        switch (status & 0xf0) {
+            case 0x80:
+            case 0x90: {
+                // a note on with velocity 0 is a note off
+                Uint32 velocity = readByte(r);
+                ev.kind = (status & 0xf0) == 0x90 && velocity > 0 ?
+                    raw_on : raw_off;
+                ev.channel = status & 0x0f;
+                ev.note = data & 0x7f;
+                ev.velocity = velocity & 0x7f;
+                if ((status & 0x0f) != DRUMS && !addRaw(raw, &ev)) {
+                    return false;
+                }
+                break;
+            }
+            case 0xa0:
+            case 0xb0:
+            case 0xe0:
+                readByte(r);
+                break;
+            default: // 0xc0 and 0xd0 have one data byte
+                if ((status & 0xf0) == 0xf0) {
+                    return false; // a system message, not in files
+                }
+                break;
+        }
+    }
+    return !r->bad;
+}
+
+static int compareRaw(const void *a, const void *b) {
+    const RawEvent *x = a;
+    const RawEvent *y = b;
+    if (x->tick != y->tick) {
+        return x->tick < y->tick ? -1 : 1;
+    }
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+/* The key note is on, or the key of the same tone in the nearest octave
+ * the keyboard has
+ */
+static Key *foldNote(Keys *keys, int note) {
+    Key *key = NULL;
+    for (int n = note; key == NULL && n < NOTES; n += 12) {
+        key = keyForNote(keys, n);
+    }
+    for (int n = note; key == NULL && n >= 0; n -= 12) {
+        key = keyForNote(keys, n);
+    }
+    return key;
+}
+
+static void holdNote(Uint8 *held, const SongEvent *ev) {
+    held[ev->key->note] = ev->on ? ev->velocity : 0;
+}
+
+/* Puts the time in samples on the sorted raw events and keeps the notes,
+ * with the seek index. Returns false if memory ran out.
+ *
+ * Notes that fold onto the same key, and the same note on several
+ * channels, share it: it goes down with each of them, but only goes up
+ * when the last of them that is down ends.
+ */
+static bool buildSong(const RawEvents *raw, int division, Keys *keys,
+        Song *song) {
+    int notes = 0;
+    for (int i = 0; i < raw->count; i++) {
+        notes += raw->events[i].kind != raw_tempo;
+    }
+    song->events = SDL_malloc(sizeof(SongEvent) * (notes ? notes : 1));
+    song->marks = SDL_malloc(sizeof(SongMark) * (notes / SONG_MARK + 1));
+    if (song->events == NULL || song->marks == NULL) {
+        return false;
+    }
+
+    // a positive division counts ticks per quarter note, and the tempo
+    // says how long that is; a negative one is SMPTE frames per second
+    // (-24, -25, -29 for 29.97 or -30) and ticks per frame
+    double tick_seconds;
+    if (division & 0x8000) {
+        int fps = 256 - (division >> 8);
+        tick_seconds = 1 / ((fps == 29 ? 29.97 : fps) * (division & 0xff));
+    } else {
+        tick_seconds = DEFAULT_TEMPO / 1e6 / division;
+    }
+    double base = 0;    // time of base_tick in seconds
+    Uint32 base_tick = 0;
+    Uint8 held[NOTES];
+    bool down[16][NOTES]; // notes of the file, on every channel
+    Uint8 sharing[NOTES]; // notes down on every key
+    SDL_memset(held, 0, sizeof(held));
+    SDL_memset(down, 0, sizeof(down));
+    SDL_memset(sharing, 0, sizeof(sharing));
+    for (int i = 0; i < raw->count; i++) {
+        const RawEvent *r = &raw->events[i];
+        double seconds = base + (r->tick - base_tick) * tick_seconds;
+        if (r->kind == raw_tempo) {
+            if (!(division & 0x8000)) {
+                base = seconds;
+                base_tick = r->tick;
+                tick_seconds = r->tempo / 1e6 / division;
+            }
+            continue;
+        }
+        Key *key = foldNote(keys, r->note);
+        bool on = r->kind == raw_on;
+        bool *was = &down[r->channel][r->note];
+        if (on != *was) {
+            sharing[key->note] += on ? 1 : -1;
+            *was = on;
+        }
+        if (!on && sharing[key->note] > 0) {
+            continue; // another note still holds the key down
+        }
+        if (song->count % SONG_MARK == 0) {
+            SDL_memcpy(song->marks[song->count / SONG_MARK].held, held,
+                    sizeof(held));
+        }
+        SongEvent *ev = &song->events[song->count++];
+        ev->frame = (Uint64)(seconds * song->rate + 0.5);
+        ev->key = key;
+        ev->on = on;
+        ev->velocity = r->velocity;
+        holdNote(held, ev);
+        song->length = ev->frame;
+    }
+    if (song->count % SONG_MARK == 0) {
+        SDL_memcpy(song->marks[song->count / SONG_MARK].held, held,
+                sizeof(held));
+    }
+    return true;
+}
+
+/* Reads the MIDI file at path for the keyboard keys, at the given sample
+ * rate. Says what is wrong and returns false if it cannot.
+ */
+bool loadSong(const char *path, Keys *keys, int rate, Song *song) {
+    SDL_memset(song, 0, sizeof(*song));
+    song->rate = rate;
+
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        printf("Could not open %s\n", path);
+        return false;
+    }
+    Uint8 *data = NULL;
+    size_t len = 0;
+    if (fseek(f, 0, SEEK_END) == 0) {
+        long size = ftell(f);
+        data = size > 0 ? SDL_malloc(size) : NULL;
+        len = data ? (size_t)size : 0;
+        rewind(f);
+    }
+    bool ok = data && fread(data, 1, len, f) == len;
+    fclose(f);
+
+    // the header, then the tracks
+    Reader r = { data, data + len, false };
+    RawEvents raw = { NULL, 0, 0 };
+    Uint32 tracks = 0;
+    int division = 0;
+    ok = ok && readNumber(&r, 4) == 0x4d546864; // MThd
+    if (ok) {
+        Uint32 size = readNumber(&r, 4);
+        Uint32 format = readNumber(&r, 2);
+        tracks = readNumber(&r, 2);
+        division = readNumber(&r, 2);
+        skip(&r, size - 6); // a longer header may come one day
+        ok = size >= 6 && (format == 0 || format == 1) && division != 0 &&
+            ((division & 0x8000) == 0 || (division & 0xff) != 0) && !r.bad;
+    }
+    for (Uint32 t = 0; ok && t < tracks && r.at < r.end; ) {
+        Uint32 id = readNumber(&r, 4);
+        Uint32 size = readNumber(&r, 4);
+        Reader track = { r.at, r.at + size, false };
+        skip(&r, size);
+        if (id == 0x4d54726b) { // MTrk, other chunks do not concern us
+            ok = !r.bad && readTrack(&track, &raw);
+            t++;
+        }
+    }
+    SDL_free(data);
+
+    if (ok) {
+        SDL_qsort(raw.events, raw.count, sizeof(RawEvent), compareRaw);
+        if (!buildSong(&raw, division, keys, song)) {
+            printf("Out of memory reading %s\n", path);
+            SDL_free(raw.events);
+            freeSong(song);
+            return false;
+        }
+    } else {
+        printf("%s is not a MIDI file this can play\n", path);
+    }
+    SDL_free(raw.events);
+    return ok;
+}
+
+void freeSong(Song *song) {
+    SDL_free(song->events);
+    SDL_free(song->marks);
+    song->events = NULL;
+    song->marks = NULL;
+    song->count = 0;
+}
+
+/* Moves the song to frame: the next event is the first one there or after
+ * it. held gets the notes that sound at that point, the velocity of every
+ * note number or 0. Render thread only.
+ */
+void seekSong(Song *song, Uint64 frame, Uint8 *held) {
+    int lo = 0;
+    int hi = song->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (song->events[mid].frame < frame) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    int mark = lo / SONG_MARK;
+    SDL_memcpy(held, song->marks[mark].held, NOTES);
+    for (int i = mark * SONG_MARK; i < lo; i++) {
+        holdNote(held, &song->events[i]);
+    }
+    song->next = lo;
+    song->frame = frame;
+    SDL_AtomicSet(&song->at_ms, (int)(frame * 1000 / song->rate));
+}
+
+/* Asks the render thread to go to the given point of the song before its
+ * next buffer, from any thread
+ */
+void requestSeek(Song *song, double seconds) {
+    double ms = seconds > 0 ? seconds * 1000 : 0;
+    SDL_AtomicSet(&song->seek, ms < SDL_MAX_SINT32 - 1 ? (int)ms + 1 :
+            SDL_MAX_SINT32);
+}
+
+/* Where the song is playing, in seconds, from any thread
+ */
+double songPosition(Song *song) {
+    return SDL_AtomicGet(&song->at_ms) / 1000.0;
+}
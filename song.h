@@ -0,0 +1,52 @@
+#ifndef SONG_H
+#define SONG_H
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+#include "voice.h"
+
+struct Key;
+struct Keys;
+
+#define SONG_MARK 1024  // events between two entries of the seek index
+
+/* A note of the song going down or up, at the sample it happens
+ */
+typedef struct SongEvent {
+    Uint64 frame;
+    struct Key *key;
+    bool on;
+    Uint8 velocity; // 1 to 127 for a note on
+} SongEvent;
+
+/* Which notes sound just before event number i * SONG_MARK, with the
+ * velocity they started with, 0 for the others
+ */
+typedef struct SongMark {
+    Uint8 held[NOTES];
+} SongMark;
+
+/* A Standard MIDI File, parsed once into the note events of all its tracks,
+ * sorted by time and mapped to keys, so that playing it is only walking
+ * along an array. The render thread plays it, see renderAudio; others only
+ * ask it to seek and look at where it is.
+ */
+typedef struct Song {
+    SongEvent *events;
+    int count;
+    SongMark *marks;    // one for every SONG_MARK events, see seekSong
+    int rate;           // the frames are samples at this rate
+    Uint64 length;      // frame of the last event
+    int next;           // next event to play, render thread only
+    Uint64 frame;       // where it is playing, render thread only
+    SDL_atomic_t seek;  // ms to go to, plus 1, 0 for none
+    SDL_atomic_t at_ms; // where it is playing, for other threads
+} Song;
+
+bool loadSong(const char *path, struct Keys *keys, int rate, Song *song);
+void freeSong(Song *song);
+void seekSong(Song *song, Uint64 frame, Uint8 *held);
+void requestSeek(Song *song, double seconds);
+double songPosition(Song *song);
+
+#endif
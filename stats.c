@@ -0,0 +1,144 @@
+#include <math.h>
+#include <stdio.h>
+#include "osc.h"
+#include "stats.h"
+
+void resetHistogram(Histogram *hist) {
+    SDL_memset(hist, 0, sizeof(*hist));
+}
+
+/* Counts one duration, anything under HIST_MIN goes in the first bin and
+ * anything past the last bin in the last
+ */
+void addDuration(Histogram *hist, double seconds) {
+    double at = seconds > HIST_MIN ?
+        log2(seconds / HIST_MIN) * HIST_PER_OCTAVE : 0;
+    int bin = at < HIST_BINS - 1 ? (int)at : HIST_BINS - 1;
+    hist->bins[bin]++;
+    hist->count++;
+    if (seconds > hist->max) {
+        hist->max = seconds;
+    }
+}
+
+/* Duration that p percent of the counted ones did not exceed, rounded up to
+ * the bin it falls in. 0 if nothing was counted.
+ */
+double percentile(const Histogram *hist, double p) {
+    Uint64 want = (Uint64)(hist->count * p / 100.0 + 0.5);
+    Uint64 seen = 0;
+    if (hist->count == 0) {
+        return 0;
+    }
+    for (int i = 0; i < HIST_BINS - 1; i++) {
+        seen += hist->bins[i];
+        if (seen >= want && seen > 0) {
+            double top = HIST_MIN * exp2((i + 1.0) / HIST_PER_OCTAVE);
+            return top < hist->max ? top : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+void resetLatency(Latency *latency) {
+    resetHistogram(&latency->callback);
+    resetHistogram(&latency->note);
+    resetHistogram(&latency->midi);
+    resetHistogram(&latency->record);
+    latency->overruns = 0;
+    latency->budget = 0;
+}
+
+/* Writes a summary to the log, in milliseconds
+ */
+void logLatency(const Latency *latency) {
+    const Histogram *cb = &latency->callback;
+    const Histogram *note = &latency->note;
+    const Histogram *midi = &latency->midi;
+    const Histogram *rec = &latency->record;
+    SDL_Log("callback: %u buffers of %.2f ms, took %.3f/%.3f/%.3f/%.3f ms "
+            "(50/99/99.9%%/max), %u overran",
+            cb->count, latency->budget * 1000, percentile(cb, 50) * 1000,
+            percentile(cb, 99) * 1000, percentile(cb, 99.9) * 1000,
+            cb->max * 1000, latency->overruns);
+    if (note->count) {
+        SDL_Log("key to first rendered sample: %u notes, %.2f/%.2f/%.2f ms "
+                "(50/99/max), plus %.2f ms for the buffer to play",
+                note->count, percentile(note, 50) * 1000,
+                percentile(note, 99) * 1000, note->max * 1000,
+                latency->budget * 1000);
+    }
+    if (midi->count) {
+        SDL_Log("MIDI byte read to first rendered sample: %u notes, "
+                "%.2f/%.2f/%.2f ms (50/99/max)", midi->count,
+                percentile(midi, 50) * 1000, percentile(midi, 99) * 1000,
+                midi->max * 1000);
+    }
+    if (rec->count) {
+        SDL_Log("recording: %u buffers copied in %.3f/%.3f/%.3f ms "
+                "(50/99.9/max)", rec->count, percentile(rec, 50) * 1000,
+                percentile(rec, 99.9) * 1000, rec->max * 1000);
+    }
+}
+
+/* Adds the stats of a buffer, only ever called from the audio thread
+ */
+void logBuffer(StatsLog *log, const BufferStats *stats) {
+    int count = SDL_AtomicGet(&log->count);
+    log->buffers[count & (STATS_HISTORY - 1)] = *stats;
+    SDL_MemoryBarrierRelease(); // the slot must be written before it counts
+    SDL_AtomicSet(&log->count, count + 1);
+}
+
+/* Copies the stats of the most recent buffer, from any thread. Returns false
+ * if there are none yet.
+ */
+bool latestBuffer(StatsLog *log, BufferStats *stats) {
+    for (;;) {
+        int count = SDL_AtomicGet(&log->count);
+        if (count == 0) {
+            return false;
+        }
+        SDL_MemoryBarrierAcquire();
+        *stats = log->buffers[(count - 1) & (STATS_HISTORY - 1)];
+        SDL_MemoryBarrierAcquire(); // done copying before looking again
+        // the writer only ever touches the slot after the last one, so the
+        // copy is whole unless it went all the way around meanwhile
+        if (SDL_AtomicGet(&log->count) - count < STATS_HISTORY - 1) {
+            return true;
+        }
+    }
+}
+
+/* Writes the logged buffers, oldest first, as CSV with times in
+ * milliseconds. Only once the audio thread has stopped logging.
+ */
+bool writeStatsCsv(StatsLog *log, const char *path) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        return false;
+    }
+    int count = SDL_AtomicGet(&log->count);
+    int first = count > STATS_HISTORY ? count - STATS_HISTORY : 0;
+    Uint64 start = log->buffers[first & (STATS_HISTORY - 1)].time;
+    double freq = (double)SDL_GetPerformanceFrequency();
+
+    fprintf(f, "time_s,frames,budget_ms,total_ms,gather_ms,osc_ms,mix_ms,"
+            "effects_ms,normalize_ms,record_ms,load,overrun,voices,wave,peak,"
+            "headroom_db,rms_db,limiter_db\n");
+    for (int i = first; i < count; i++) {
+        const BufferStats *b = &log->buffers[i & (STATS_HISTORY - 1)];
+        double headroom = b->peak > 0 ? -20 * log10(b->peak) : INFINITY;
+        double rms = b->rms > 0 ? 20 * log10(b->rms) : -INFINITY;
+        fprintf(f, "%.6f,%u,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.3f,%d,"
+                "%u,%s,%.4f,%.2f,%.2f,%.2f\n",
+                (b->time - start) / freq, b->frames, b->budget * 1000,
+                b->total * 1000, b->gather * 1000, b->osc * 1000,
+                b->mix * 1000, b->effects * 1000, b->normalize * 1000,
+                b->record * 1000,
+                b->budget > 0 ? b->total / b->budget : 0,
+                b->total > b->budget, b->voices, wave_names[b->wave],
+                b->peak, headroom, rms, 20 * log10(b->limiter));
+    }
+    return fclose(f) == 0;
+}
@@ -0,0 +1,74 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+
+#define HIST_BINS 4096      // the last one catches the rest
+#define HIST_MIN 1e-6       // seconds where the scale starts
+#define HIST_PER_OCTAVE 128 // bins, each about 0.5% wider than the last
+
+/* Distribution of durations. The bins are spaced on a log scale, from
+ * HIST_MIN up to more than an hour, so that a few microseconds and the
+ * tens of milliseconds of a big buffer both come out to within 0.5%.
+ * Filled in by one thread without locking, only to be read once that
+ * thread is done with it.
+ */
+typedef struct Histogram {
+    Uint32 bins[HIST_BINS];
+    Uint32 count;
+    double max;     // longest, in seconds
+} Histogram;
+
+/* What the audio callback measures about itself
+ */
+typedef struct Latency {
+    Histogram callback; // time spent rendering a buffer
+    Histogram note;     // from a key event until its first sample is rendered
+    Histogram midi;     // the same for notes from MIDI input
+    Histogram record;   // copying a buffer for the recorder
+    Uint32 overruns;    // buffers that took longer to render than to play
+    double budget;      // playing time of the last buffer, in seconds
+} Latency;
+
+/* Where the time in a buffer went, and what it was playing
+ */
+typedef struct BufferStats {
+    Uint64 time;    // performance counter at the start of the buffer
+    float budget;   // playing time of the buffer, in seconds
+    float total;    // time spent in the callback, in seconds
+    float gather;   // on note events, voice bookkeeping and the rest
+    float osc;      // rendering oscillators
+    float mix;      // applying envelopes and adding voices to the mix
+    float effects;  // running the mix through the effects bus
+    float normalize; // gain, spreading over channels and converting
+    float record;   // copying it for the recorder
+    float peak;     // largest absolute sample after gain, 1 is full scale
+    float rms;      // and the root mean square of all of them
+    float limiter;  // gain of the limiter at the end of the buffer
+    Uint16 frames;
+    Uint8 voices;   // sounding at the start of the buffer
+    Uint8 wave;
+} BufferStats;
+
+#define STATS_HISTORY 8192 // buffers, a power of 2
+
+/* The last STATS_HISTORY buffers. The audio thread fills in the next slot
+ * and only then counts it, so a reader that sees the count has not moved
+ * on too far afterwards has read a whole slot. No locks either way.
+ */
+typedef struct StatsLog {
+    BufferStats buffers[STATS_HISTORY];
+    SDL_atomic_t count; // buffers logged so far
+} StatsLog;
+
+void resetHistogram(Histogram *hist);
+void addDuration(Histogram *hist, double seconds);
+double percentile(const Histogram *hist, double p);
+void resetLatency(Latency *latency);
+void logLatency(const Latency *latency);
+void logBuffer(StatsLog *log, const BufferStats *stats);
+bool latestBuffer(StatsLog *log, BufferStats *stats);
+bool writeStatsCsv(StatsLog *log, const char *path);
+
+#endif
@@ -0,0 +1,966 @@
+#include <math.h>
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+#include "dsp.h"
+#include "synth.h"
+
+// the defaults, a config file can change them, see config.c
+WaveForm wave = square;
+Sint8 volume = 10;
+double A4 = 432;
+int polyphony = 32;
+
+// attack, decay, sustain level and release for every wave form; the FM
+// ones are shaped by their operators' envelopes, see fm.c, and only
+// need this one to end
+Envelope envelopes[WAVE_FORMS] = {
+    { 0.005, 0.20, 0.70, 0.20 },    // square
+    { 0.005, 0.20, 0.70, 0.20 },    // triangle
+    { 0.005, 0.20, 0.70, 0.20 },    // saw
+    { 0.002, 0.10, 0.50, 0.10 },    // noise
+    { 0.010, 0.30, 0.80, 0.30 },    // sine
+    { 0.002, 0.10, 1.00, 0.30 },    // opl2_1
+    { 0.002, 0.10, 1.00, 0.30 },    // opl2_2
+    { 0.002, 0.10, 1.00, 0.30 }     // opl2_3
+};
+StealMode steal_mode = steal_oldest;
+// keep the voice count down to what renders in time for small buffers
+bool low_latency = false;
+// threads that render voices, and whether they always split them alike
+int render_threads = 1;
+bool deterministic = false;
+
+// the keycodes that play the keys unless a config file says otherwise,
+// with shift for the black ones
+const Binding key_bindings[KEY_BINDINGS] = {
+    { "C2", '1' }, { "D2", '2' }, { "E2", '3' }, { "F2", '4' },
+    { "G2", '5' }, { "A3", '6' }, { "B3", '7' }, { "C3", '8' },
+    { "D3", '9' }, { "E3", '0' }, { "F3", 'q' }, { "G3", 'w' },
+    { "A4", 'e' }, { "B4", 'r' }, { "C4", 't' }, { "D4", 'y' },
+    { "E4", 'u' }, { "F4", 'i' }, { "G4", 'o' }, { "A5", 'p' },
+    { "B5", 'a' }, { "C5", 's' }, { "D5", 'd' }, { "E5", 'f' },
+    { "F5", 'g' }, { "G5", 'h' }, { "A6", 'j' }, { "B6", 'k' },
+    { "C6", 'l' }, { "D6", 'z' }, { "E6", 'x' }, { "F6", 'c' },
+    { "G6", 'v' }, { "A7", 'b' }, { "B7", 'n' }, { "C7", 'm' },
+
+    { "C2#", '1' }, { "D2#", '2' }, { "F2#", '4' }, { "G2#", '5' },
+    { "A3#", '6' }, { "C3#", '8' }, { "D3#", '9' }, { "F3#", 'q' },
+    { "G3#", 'w' }, { "A4#", 'e' }, { "C4#", 't' }, { "D4#", 'y' },
+    { "F4#", 'i' }, { "G4#", 'o' }, { "A5#", 'p' }, { "C5#", 's' },
+    { "D5#", 'd' }, { "F5#", 'g' }, { "G5#", 'h' }, { "A6#", 'j' },
+    { "C6#", 'l' }, { "D6#", 'z' }, { "F6#", 'c' }, { "G6#", 'v' },
+    { "A7#", 'b' }
+};
+
+/* Helper to connect a keyboard key to a certain tone
+ */
+bool keyToTone(Key* keys, int len, const char *s, char c) {
+    for (int i = 0; i < len; i++) {
+        if (strncmp(keys[i].tone, s, 3) == 0) {
+            keys[i].key = c;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* The twelve tones of the octave from a4 up, in ascending order: fifths
+ * stacked on a4, each brought back into the octave
+ */
+static void scale(double a4, double sorted[12]) {
+    double tone = a4;
+    double tones[12];
+    double next_octave = a4 * 2;
+    for (int i = 0; i < 12; i++) {
+        tones[i] = tone;
+        tone = tone / 2 * 3;
+        if (tone > next_octave) {
+            tone = tone / 2;
+        }
+    }
+    // sort them ascending
+    for (int i = 0; i < 12; i++) {
+        double smallest = 100000;
+        int small_pos = -1;
+        for (int j = 0; j < 12; j++) {
+            if (tones[j] < smallest) {
+                smallest = tones[j];
+                small_pos = j;
+            }
+        }
+        sorted[i] = tones[small_pos];
+        tones[small_pos] = 100000;
+    }
+}
+
+/* Gives every key its frequency for the given A4: its tone in the octave
+ * above A4, moved by whole octaves. Main thread only, the audio thread plays
+ * the engine's Tuning, see retune.
+ */
+void tuneKeys(Keys *keys, double a4) {
+    double sorted[12];
+    scale(a4, sorted);
+    for (int i = 0; i < keys->w_len + keys->b_len; i++) {
+        Key *key = i < keys->w_len ? &keys->white[i] :
+            &keys->black[i - keys->w_len];
+        int index = ((key->note - 69) % 12 + 12) % 12;
+        key->freq = ldexp(sorted[index], (key->note - 69 - index) / 12);
+    }
+}
+
+/* Binds keycodes to keys, replacing the bindings there were. Tones there is
+ * no key for are left out. Main thread only, like keyForChar.
+ */
+void bindKeys(Keys *keys, const Binding *bindings, int len) {
+    Key* white = keys->white;
+    Key* black = keys->black;
+    for (int i = 0; i < keys->w_len; i++) {
+        white[i].key = 0;
+    }
+    for (int i = 0; i < keys->b_len; i++) {
+        black[i].key = 0;
+    }
+    for (int i = 0; i < len; i++) {
+        if (!keyToTone(white, keys->w_len, bindings[i].tone, bindings[i].key)) {
+            keyToTone(black, keys->b_len, bindings[i].tone, bindings[i].key);
+        }
+    }
+
+    // so that a keycode finds its key without searching, the first key
+    // bound to it wins
+    SDL_memset(keys->by_char, 0, sizeof(keys->by_char));
+    for (int i = keys->w_len - 1; i >= 0; i--) {
+        if (white[i].key > 0) { // char is ASCII, 0 for none
+            keys->by_char[0][(int)white[i].key] = &white[i];
+        }
+    }
+    for (int i = keys->b_len - 1; i >= 0; i--) {
+        if (black[i].key > 0) {
+            keys->by_char[1][(int)black[i].key] = &black[i];
+        }
+    }
+}
+
+/* initializes arrays of black and white struct Key, starting from the key
+ * indicated by s_key in s_octave, ending on e_key in e_octave
+ *   alwas start and end with a white key 
+ * then tunes them to A4 and gives them the default keycodes
+ */
+void setupKeys(Keys* keys,
+        char s_key, int s_octave, char e_key, int e_octave) {
+    Key* white = keys->white;
+    Key* black = keys->black;
+
+    // start by makeing sure the everything is zero
+    SDL_memset(white, 0, sizeof(Key) * keys->w_len);
+    SDL_memset(black, 0, sizeof(Key) * keys->b_len);
+
+    // go to requested start octave (cannot be > 4)
+    int octave = s_octave < 4 ? s_octave : 4;
+    // go to requested start key
+    char bw[] = {'w','b','w','w','b','w','b','w','w','b','w','b'};
+    int index = 0;
+    char k = 'A';
+    while (k < s_key) {
+        index++;
+        if (bw[index] == 'b') {
+            index++;
+        }
+        k++;
+    }
+    // setup keys of the first (requested) octave
+    int wi = 0;
+    int bi = 0;
+    while (index < 12) {
+        if (bw[index] == 'w') {
+            white[wi].tone[0] = k;
+            white[wi].tone[1] = 0x30 + octave;
+            white[wi].note = 69 + 12 * (octave - 4) + index;
+            wi++;
+        } else { // 'b'
+            black[bi].tone[0] = k;
+            black[bi].tone[1] = 0x30 + octave;
+            black[bi].note = 69 + 12 * (octave - 4) + index;
+            black[bi].tone[2] = '#';
+            bi++;
+        }
+        if (index < 11 && bw[index + 1] == 'w') {
+            k++;
+        }
+        index++;
+    }
+    octave++;
+    // do all the in-between octaves
+    while (octave < e_octave) {
+        k = 'A';
+        for (index = 0; index < 12; index++) {
+            if (bw[index] == 'w') {
+                white[wi].tone[0] = k;
+                white[wi].tone[1] = 0x30 + octave;
+                white[wi].note = 69 + 12 * (octave - 4) + index;
+                wi++;
+            } else { // 'b'
+                black[bi].tone[0] = k;
+                black[bi].tone[1] = 0x30 + octave;
+                black[bi].note = 69 + 12 * (octave - 4) + index;
+                black[bi].tone[2] = '#';
+                bi++;
+            }
+            if (index < 11 && bw[index + 1] == 'w') {
+                k++;
+            }
+        }
+        octave++;
+    }
+    // then the last octave
+    index = 0;
+    k = 'A';
+    while (k <= e_key && wi < keys->w_len) {
+        if (bw[index] == 'w') {
+            white[wi].tone[0] = k;
+            white[wi].tone[1] = 0x30 + octave;
+            white[wi].note = 69 + 12 * (octave - 4) + index;
+            wi++;
+        } else { // 'b'
+            black[bi].tone[0] = k;
+            black[bi].tone[1] = 0x30 + octave;
+            black[bi].note = 69 + 12 * (octave - 4) + index;
+            black[bi].tone[2] = '#';
+            bi++;
+        }
+        if (index < 11 && bw[index + 1] == 'w') {
+            k++;
+        }
+        index++;
+    }
+
+    SDL_memset(keys->by_note, 0, sizeof(keys->by_note));
+    for (int i = 0; i < keys->w_len; i++) {
+        keys->by_note[white[i].note] = &white[i];
+    }
+    for (int i = 0; i < keys->b_len; i++) {
+        keys->by_note[black[i].note] = &black[i];
+    }
+    tuneKeys(keys, A4);
+    bindKeys(keys, key_bindings, KEY_BINDINGS);
+}
+
+/* The key that keycode c plays, with or without shift, or NULL
+ */
+Key *keyForChar(Keys *keys, int c, bool shift) {
+    if (c <= 0 || c >= KEY_CHARS) {
+        return NULL;
+    }
+    return keys->by_char[shift][c];
+}
+
+/* The key of MIDI note number note, or NULL if the keyboard has none
+ */
+Key *keyForNote(Keys *keys, int note) {
+    if (note < 0 || note >= NOTES) {
+        return NULL;
+    }
+    return keys->by_note[note];
+}
+
+/* Looks up a key by the name of its tone, eg "A4" or "C5#"
+ */
+Key *findKey(Keys *keys, const char *tone) {
+    for (int i = 0; i < keys->w_len; i++) {
+        if (SDL_strncmp(keys->white[i].tone, tone, 4) == 0) {
+            return &keys->white[i];
+        }
+    }
+    for (int i = 0; i < keys->b_len; i++) {
+        if (SDL_strncmp(keys->black[i].tone, tone, 4) == 0) {
+            return &keys->black[i];
+        }
+    }
+    return NULL;
+}
+
+// what the render threads need to know about the part of a buffer
+typedef struct VoiceJob {
+    Engine *engine;
+    int alen;
+    int sounding;
+} VoiceJob;
+
+/* Renders one voice and adds it to the mix of the lane of the thread that
+ * does it. Voices are done from the last to the first, as they always were,
+ * so a single thread adds them up in the same order.
+ */
+static void renderVoice(void *data, int thread, int item) {
+    VoiceJob *job = data;
+    Engine *engine = job->engine;
+    Lane *lane = &engine->lanes[thread];
+    Voice *voice = &engine->voices.voice[job->sounding - 1 - item];
+    Envelope *shape = &envelopes[engine->wave];
+    int rate = engine->spec.freq;
+    int alen = job->alen;
+
+    // the oscillator remembers where we are in the wave, so that
+    // we can continue there when generating the next buffer
+    Uint64 start = SDL_GetPerformanceCounter();
+    const float *table = waveTable(&engine->tables, engine->wave, voice->note);
+    const FmPatch *patch = fmPatch(engine->wave);
+    setOscFreq(&voice->osc, engine->tuned->freq[voice->note], rate);
+    if (patch) {
+        renderFm(&voice->fm, patch, engine->tuned->freq[voice->note], rate,
+                lane->voice, alen);
+    } else if (table) {
+        renderTable(&voice->osc, table, lane->voice, alen);
+    } else {
+        runOsc(&voice->osc, engine->kernel, lane->voice, alen);
+    }
+    Uint64 rendered = SDL_GetPerformanceCounter();
+
+    // the envelope comes as a few straight lines per buffer at most, FM
+    // still at the scale of its operators
+    float gain = patch ? voice->gain * (1.0f / FM_FULL) : voice->gain;
+    int done = 0;
+    while (done < alen && voice->env.stage != env_done) {
+        float from, step;
+        int n = envelopeRamp(&voice->env, shape, rate, alen - done,
+                &from, &step);
+        dsp->addRamp(lane->mix + done, lane->voice + done, n,
+                from * gain, step * gain);
+        done += n;
+    }
+    lane->osc_ticks += rendered - start;
+    lane->mix_ticks += SDL_GetPerformanceCounter() - rendered;
+}
+
+/* Helper to put frequency waves into the engine's mix buffer. Only looks at
+ * the voices that are sounding, however many keys there are. With a worker
+ * pool they are shared out over its threads, each with a mix of its own,
+ * and the mixes added up in thread order. Voices whose envelope has died
+ * away are retired afterwards, by this thread alone.
+ */
+int addFrequencies(Engine *engine, int alen) {
+    Voices *voices = &engine->voices;
+    int sounding = voices->active;
+    int threads = engine->pool ? engine->pool->threads : 1;
+    VoiceJob job = { engine, alen, sounding };
+
+    for (int t = 0; t < threads; t++) {
+        engine->lanes[t].osc_ticks = 0;
+        engine->lanes[t].mix_ticks = 0;
+    }
+    if (threads > 1 && sounding > 1) {
+        for (int t = 1; t < threads; t++) {
+            SDL_memset(engine->lanes[t].mix, 0, sizeof(float) * alen);
+        }
+        runPool(engine->pool, renderVoice, &job, sounding, deterministic);
+        Uint64 start = SDL_GetPerformanceCounter();
+        for (int t = 1; t < threads; t++) {
+            dsp->add(engine->mix, engine->lanes[t].mix, alen);
+        }
+        engine->mix_ticks += SDL_GetPerformanceCounter() - start;
+    } else {
+        for (int i = 0; i < sounding; i++) {
+            renderVoice(&job, 0, i);
+        }
+    }
+    for (int t = 0; t < threads; t++) {
+        engine->osc_ticks += engine->lanes[t].osc_ticks;
+        engine->mix_ticks += engine->lanes[t].mix_ticks;
+    }
+
+    // backwards, so that retiring a voice only moves one we already did
+    for (int v = sounding - 1; v >= 0; v--) {
+        if (voices->voice[v].env.stage == env_done) {
+            stopVoice(voices, voices->voice[v].note);
+        }
+    }
+    return sounding;
+}
+
+/* Whether renderAudio can write this format itself: signed 8, 16 or 32 bit
+ * or float, in native byte order, with any number of channels and any rate.
+ * For anything else the device has to be asked for one of these and SDL
+ * left to convert.
+ */
+bool canRender(const SDL_AudioSpec *spec) {
+    switch (spec->format) {
+        case AUDIO_S8:
+        case AUDIO_S16SYS:
+        case AUDIO_S32SYS:
+        case AUDIO_F32SYS:
+            return spec->channels > 0;
+        default:
+            return false;
+    }
+}
+
+/* A tuning with the frequencies the keys have now, or NULL if there is no
+ * memory
+ */
+static Tuning *newTuning(Keys *keys) {
+    Tuning *tuning = SDL_malloc(sizeof(Tuning));
+    if (tuning == NULL) {
+        return NULL;
+    }
+    SDL_memset(tuning, 0, sizeof(*tuning));
+    for (int i = 0; i < keys->w_len; i++) {
+        tuning->freq[keys->white[i].note] = keys->white[i].freq;
+    }
+    for (int i = 0; i < keys->b_len; i++) {
+        tuning->freq[keys->black[i].note] = keys->black[i].freq;
+    }
+    return tuning;
+}
+
+/* Sizes the engine for the spec we got from the device: the mix is mono, one
+ * buffer worth of frames, and is only spread over the channels at the end.
+ * With wave_tables set the tables of the current wave get built too.
+ * Returns false if memory could not be had.
+ */
+bool setupEngine(Engine *engine, Keys *keys, SDL_AudioSpec *spec) {
+    engine->keys = keys;
+    engine->spec = *spec;
+    takeWave(engine);
+    setupFm();
+    SDL_AtomicSet(&engine->queue.head, 0);
+    SDL_AtomicSet(&engine->queue.tail, 0);
+    SDL_AtomicSet(&engine->midi.head, 0);
+    SDL_AtomicSet(&engine->midi.tail, 0);
+    engine->sustain = false;
+    for (int i = 0; i < NOTES / 32; i++) {
+        SDL_AtomicSet(&engine->held[i], 0);
+    }
+    engine->last_start = SDL_GetPerformanceCounter();
+    resetLatency(&engine->latency);
+    engine->mix_len = spec->samples;
+    engine->frame_bytes = SDL_AUDIO_BITSIZE(spec->format) / 8 * spec->channels;
+    engine->mix = SDL_malloc(sizeof(float) * engine->mix_len);
+    engine->voice = SDL_malloc(sizeof(float) * engine->mix_len);
+    engine->out = NULL;
+    engine->limiter = 1;
+    SDL_memset(engine->lanes, 0, sizeof(engine->lanes));
+    engine->lanes[0].mix = engine->mix;
+    engine->lanes[0].voice = engine->voice;
+    engine->tuning = newTuning(keys);
+    engine->tuned = engine->tuning;
+    setupWaveTables(&engine->tables, spec->freq);
+    for (int i = 0; i < keys->w_len; i++) {
+        addTableNote(&engine->tables, keys->white[i].note, keys->white[i].freq);
+    }
+    for (int i = 0; i < keys->b_len; i++) {
+        addTableNote(&engine->tables, keys->black[i].note, keys->black[i].freq);
+    }
+    if (wave_tables) {
+        buildWaveTables(&engine->tables, wave);
+    }
+    engine->recorder = NULL;
+    engine->song = NULL;
+    setupEffects(&engine->effects);
+    engine->log = SDL_malloc(sizeof(StatsLog));
+    if (engine->log) {
+        SDL_AtomicSet(&engine->log->count, 0);
+    }
+    if (spec->channels > 1) {
+        engine->out = SDL_malloc(sizeof(float) * engine->mix_len *
+                spec->channels);
+    }
+
+    // the workers are started here, so the audio callback never has to
+    engine->pool = NULL;
+    bool lanes = true;
+    if (render_threads > 1) {
+        engine->pool = createPool(render_threads);
+        for (int t = 1; engine->pool && t < render_threads; t++) {
+            engine->lanes[t].mix = SDL_malloc(sizeof(float) * engine->mix_len);
+            engine->lanes[t].voice = SDL_malloc(sizeof(float) *
+                    engine->mix_len);
+            lanes = lanes && engine->lanes[t].mix && engine->lanes[t].voice;
+        }
+    }
+    return setupVoices(&engine->voices, polyphony, steal_mode) &&
+        engine->mix != NULL && engine->voice != NULL && engine->log != NULL &&
+        engine->tuning != NULL &&
+        (engine->out != NULL || spec->channels == 1) &&
+        (engine->pool != NULL || render_threads == 1) && lanes;
+}
+
+void freeEngine(Engine *engine) {
+    freePool(engine->pool);
+    for (int t = 1; t < MAX_THREADS; t++) {
+        SDL_free(engine->lanes[t].mix);
+        SDL_free(engine->lanes[t].voice);
+        engine->lanes[t].mix = NULL;
+        engine->lanes[t].voice = NULL;
+    }
+    engine->pool = NULL;
+    SDL_free(engine->mix);
+    SDL_free(engine->voice);
+    SDL_free(engine->out);
+    SDL_free(engine->log);
+    SDL_free(engine->tuning);
+    freeWaveTables(&engine->tables);
+    freeVoices(&engine->voices);
+    freeEffects(&engine->effects);
+    engine->mix = NULL;
+    engine->voice = NULL;
+    engine->out = NULL;
+    engine->log = NULL;
+    engine->tuning = NULL;
+    engine->tuned = NULL;
+    engine->mix_len = 0;
+}
+
+/* Tunes the keyboard to a new A4 while it plays: the keys get their new
+ * frequencies, the audio thread gets a new Tuning in one pointer swap, and
+ * the wave tables are built again for it. Held notes go on from where they
+ * are in their wave, at the new pitch from the next buffer on. Main thread
+ * only, it waits a while for the audio thread to finish a buffer, see
+ * dropWaveTables. Returns false if memory could not be had, then the
+ * tuning stays as it was.
+ */
+bool retune(Engine *engine, double a4) {
+    extern double A4;
+    Keys *keys = engine->keys;
+    double old_a4 = A4;
+
+    tuneKeys(keys, a4);
+    Tuning *tuning = newTuning(keys);
+    if (tuning == NULL) {
+        tuneKeys(keys, old_a4);
+        return false;
+    }
+    A4 = a4;
+    Tuning *old = SDL_AtomicSetPtr((void**)&engine->tuning, tuning);
+
+    // the old tuning goes when the old tables do, once the buffer that may
+    // have got hold of them is over
+    freeLater(&engine->tables, old);
+    dropWaveTables(&engine->tables);
+    for (int i = 0; i < keys->w_len; i++) {
+        addTableNote(&engine->tables, keys->white[i].note, keys->white[i].freq);
+    }
+    for (int i = 0; i < keys->b_len; i++) {
+        addTableNote(&engine->tables, keys->black[i].note, keys->black[i].freq);
+    }
+    if (wave_tables) {
+        buildWaveTables(&engine->tables, wave);
+    }
+    return true;
+}
+
+/* Adds an event to the queue, only to be called from one thread at a time.
+ * Returns false if the queue is full.
+ */
+bool pushEvent(EventQueue *queue, const NoteEvent *ev) {
+    int head = SDL_AtomicGet(&queue->head);
+    int next = (head + 1) & (EVENT_QUEUE_SIZE - 1);
+    if (next == SDL_AtomicGet(&queue->tail)) {
+        return false;
+    }
+    queue->events[head] = *ev;
+    SDL_MemoryBarrierRelease(); // the event must be there before the head moves
+    SDL_AtomicSet(&queue->head, next);
+    return true;
+}
+
+/* Copies the oldest event in the queue into ev without taking it out.
+ * Returns false if the queue is empty.
+ */
+bool peekEvent(EventQueue *queue, NoteEvent *ev) {
+    int tail = SDL_AtomicGet(&queue->tail);
+    if (tail == SDL_AtomicGet(&queue->head)) {
+        return false;
+    }
+    SDL_MemoryBarrierAcquire(); // see the event the moved head points past
+    *ev = queue->events[tail];
+    return true;
+}
+
+/* Drops the oldest event, after peekEvent said there is one
+ */
+void popEvent(EventQueue *queue) {
+    int tail = SDL_AtomicGet(&queue->tail);
+    SDL_MemoryBarrierRelease(); // done reading the slot before handing it back
+    SDL_AtomicSet(&queue->tail, (tail + 1) & (EVENT_QUEUE_SIZE - 1));
+}
+
+/* Timestamps a key going down or up and sends it to the audio thread
+ */
+bool sendNote(Engine *engine, Key *key, bool on) {
+    NoteEvent ev;
+    ev.time = SDL_GetPerformanceCounter();
+    ev.key = key;
+    ev.on = on;
+    ev.velocity = FULL_VELOCITY;
+    return pushEvent(&engine->queue, &ev);
+}
+
+/* Reads the global wave once, for a whole buffer: the main thread may
+ * change it at any time, and every voice in a buffer should still get the
+ * same wave form. The kernel for it is picked right away, so no voice has
+ * to look at the wave form again.
+ */
+void takeWave(Engine *engine) {
+    extern WaveForm wave;
+    engine->wave = wave;
+    engine->kernel = oscKernel(engine->wave);
+}
+
+/* Makes an event take effect, on the thread that renders. The velocity
+ * sets the voice's gain, on a square law: half as hard is a quarter as
+ * loud, about 12 dB down. While the sustain pedal is down keys that go up
+ * keep sounding, until the pedal goes up too.
+ */
+void applyEvent(Engine *engine, const NoteEvent *ev) {
+    Envelope *shape = &envelopes[engine->wave];
+    Voice *voice;
+    if (ev->key == NULL) {
+        engine->sustain = ev->on;
+        for (int i = 0; i < engine->voices.active && !ev->on; i++) {
+            voice = &engine->voices.voice[i];
+            if (voice->sustained) {
+                voice->sustained = false;
+                releaseEnvelope(&voice->env, shape, engine->spec.freq);
+            }
+        }
+    } else if (ev->on) {
+        voice = startVoice(&engine->voices, ev->key, ev->key->note);
+        if (voice) {
+            float v = ev->velocity / (float)FULL_VELOCITY;
+            voice->gain = v * v;
+            voice->sustained = false;
+            startEnvelope(&voice->env, shape, engine->spec.freq);
+            attackFm(&voice->fm);
+        }
+    } else {
+        voice = findVoice(&engine->voices, ev->key->note);
+        if (voice && engine->sustain) {
+            voice->sustained = true;
+        } else if (voice) {
+            releaseEnvelope(&voice->env, shape, engine->spec.freq);
+        }
+    }
+}
+
+/* Converts len samples of float audio into the engine's output format
+ */
+static void convert(Engine *engine, Uint8 *stream, const float *audio,
+        int len) {
+    switch (engine->spec.format) {
+        case AUDIO_S16SYS:
+            dsp->toS16((Sint16*)stream, audio, len);
+            break;
+        case AUDIO_S32SYS:
+            dsp->toS32((Sint32*)stream, audio, len);
+            break;
+        case AUDIO_F32SYS:
+            dsp->toF32((float*)stream, audio, len);
+            break;
+        default:
+            dsp->toS8((Sint8*)stream, audio, len);
+            break;
+    }
+}
+
+#define LIMITER_KNEE 0.7f    // peaks up to here pass untouched, about -3 dB
+#define LIMITER_RELEASE 0.2f  // seconds to come back from the deepest cut
+
+/* Gain that brings a block whose loudest sample is peak under full scale.
+ * Below the knee that is 1, above it the peak is bent over softly towards
+ * 1 (tanh has slope 1 at the knee and never quite gets there), so a chord
+ * gets louder with every key but never clips. Worked out once per block,
+ * whatever the number of voices.
+ */
+static float limiterGain(float peak) {
+    const float room = 1 - LIMITER_KNEE;
+    if (peak <= LIMITER_KNEE) {
+        return 1;
+    }
+    return (LIMITER_KNEE + room * tanhf((peak - LIMITER_KNEE) / room)) / peak;
+}
+
+/* Mixes all pressed keys into frames frames of stream. Every voice already
+ * has its own gain, see renderVoice; the sum goes through the effects, if
+ * they are not bypassed, and then only gets the master volume and the
+ * limiter, which cuts the gain at once when a block would clip and lets
+ * it come back slowly, as a ramp over the block. Both are a single pass over
+ * the block, as are the meter and the conversion.
+ */
+static void renderFrames(Engine *engine, Uint8 *stream, int frames) {
+    extern Sint8 volume;
+    float *audio = engine->mix;
+    int channels = engine->spec.channels;
+    float master = volume / 128.0f;
+
+    // SDL may ask for more than the buffer we sized for, do it in parts
+    while (frames > 0) {
+        int alen = frames < engine->mix_len ? frames : engine->mix_len;
+        SDL_memset(audio, 0, sizeof(float) * alen);
+
+        bool sound = addFrequencies(engine, alen) > 0;
+        if (engine->effects.on) {
+            Uint64 start = SDL_GetPerformanceCounter();
+            sound = runEffects(&engine->effects, audio, alen, sound);
+            engine->effects_ticks += SDL_GetPerformanceCounter() - start;
+        }
+
+        // master volume (out of 128) and limiter in one go, then the
+        // meter and the conversion into the stream
+        if (sound) {
+            Uint64 start = SDL_GetPerformanceCounter();
+            float from = engine->limiter;
+            float to = limiterGain(dsp->peak(audio, alen) * master);
+            float step = 0;
+            if (to < from) {
+                from = to; // at once, the peak may be in the first sample
+            } else {
+                float most = from +
+                    alen / (LIMITER_RELEASE * engine->spec.freq);
+                to = to < most ? to : most;
+                step = (to - from) / alen;
+            }
+            engine->limiter = to;
+            dsp->gainRamp(audio, alen, master * from, master * step);
+
+            float peak = dsp->peak(audio, alen);
+            if (peak > engine->peak) {
+                engine->peak = peak;
+            }
+            engine->energy += dsp->energy(audio, alen);
+            if (channels > 1) {
+                dsp->spread(engine->out, audio, alen, channels);
+                convert(engine, stream, engine->out, alen * channels);
+            } else {
+                convert(engine, stream, audio, alen);
+            }
+            engine->normalize_ticks += SDL_GetPerformanceCounter() - start;
+        }
+        stream += alen * engine->frame_bytes;
+        frames -= alen;
+    }
+}
+
+// when the notes applied in a buffer happened, for engine->latency
+typedef struct Applied {
+    Uint64 time[16];
+    int count;
+} Applied;
+
+/* Keeps the statistics on a buffer that has just been rendered, sounding is
+ * how many voices there were when it started, applied when the notes in it
+ * happened, from the keyboard and from MIDI. In low latency mode it also
+ * fits the number of voices to the time there is: above 3/4 of the buffer's
+ * playing time new notes take over old voices instead of adding to them,
+ * below half of it the limit grows back.
+ */
+static void measureBuffer(Engine *engine, int frames, int sounding,
+        const Applied *applied) {
+    Latency *latency = &engine->latency;
+    Voices *voices = &engine->voices;
+    Uint64 end = SDL_GetPerformanceCounter();
+    double freq = (double)SDL_GetPerformanceFrequency();
+    double took = (end - engine->last_start) / freq;
+    if (frames == 0) {
+        return;
+    }
+
+    latency->budget = (double)frames / engine->spec.freq;
+    addDuration(&latency->callback, took);
+    if (took > latency->budget) {
+        latency->overruns++;
+    }
+    for (int i = 0; i < applied[0].count; i++) {
+        addDuration(&latency->note, (end - applied[0].time[i]) / freq);
+    }
+    for (int i = 0; i < applied[1].count; i++) {
+        addDuration(&latency->midi, (end - applied[1].time[i]) / freq);
+    }
+    if (engine->recorder) {
+        addDuration(&latency->record, engine->record_ticks / freq);
+    }
+
+    BufferStats stats;
+    stats.time = engine->last_start;
+    stats.budget = latency->budget;
+    stats.total = took;
+    stats.osc = engine->osc_ticks / freq;
+    stats.mix = engine->mix_ticks / freq;
+    stats.effects = engine->effects_ticks / freq;
+    stats.normalize = engine->normalize_ticks / freq;
+    stats.record = engine->record_ticks / freq;
+    stats.gather = stats.total - stats.osc - stats.mix - stats.effects -
+        stats.normalize - stats.record;
+    stats.peak = engine->peak;
+    stats.rms = sqrtf(engine->energy / frames);
+    stats.limiter = engine->limiter;
+    stats.frames = frames;
+    stats.voices = sounding;
+    stats.wave = engine->wave;
+    logBuffer(engine->log, &stats);
+
+    if (low_latency) {
+        if (took > latency->budget * 0.75) {
+            voices->limit = voices->active > 1 ? voices->active - 1 : 1;
+        } else if (took < latency->budget * 0.5 &&
+                voices->limit < voices->capacity) {
+            voices->limit++;
+        }
+    }
+}
+
+/* Moves the song to where another thread asked it to go, see requestSeek:
+ * whatever sounds is let go, and the notes that are held at the new place
+ * start as if their keys had just gone down. Takes the same time wherever
+ * that is, see seekSong.
+ */
+static void takeSeek(Engine *engine) {
+    Song *song = engine->song;
+    int ms = SDL_AtomicSet(&song->seek, 0);
+    if (ms == 0) {
+        return;
+    }
+    Uint8 held[NOTES];
+    seekSong(song, (Uint64)(ms - 1) * song->rate / 1000, held);
+    Envelope *shape = &envelopes[engine->wave];
+    for (int i = 0; i < engine->voices.active; i++) {
+        releaseEnvelope(&engine->voices.voice[i].env, shape, engine->spec.freq);
+    }
+    for (int n = 0; n < NOTES; n++) {
+        if (held[n]) {
+            NoteEvent ev = { 0, keyForNote(engine->keys, n), true, held[n] };
+            applyEvent(engine, &ev);
+        }
+    }
+}
+
+/* Tells the other threads which notes are held down: those with a voice
+ * that has not been let go yet, or only while the pedal is down
+ */
+static void publishHeld(Engine *engine) {
+    Uint32 held[NOTES / 32] = { 0 };
+    for (int i = 0; i < engine->voices.active; i++) {
+        const Voice *voice = &engine->voices.voice[i];
+        if (voice->env.stage < env_release) {
+            held[voice->note / 32] |= 1u << (voice->note % 32);
+        }
+    }
+    for (int i = 0; i < NOTES / 32; i++) {
+        SDL_AtomicSet(&engine->held[i], (int)held[i]);
+    }
+}
+
+/* Renders len bytes of audio into stream, in the engine's format (S8, S16,
+ * S32 or F32, any number of channels). This is what the audio callback runs
+ * on SDL's real-time thread, so no allocating or locking in here, everything
+ * it needs was set up by setupEngine. The only system calls are those of a
+ * worker pool (-j): posting the semaphore of a worker that has parked, at
+ * most once per worker and buffer, and yielding while it waits for the
+ * last worker once it has spun for long enough, see runPool.
+ *
+ * Queued note events are applied at the sample they belong to: an event is
+ * placed in this buffer at the same distance from its start as it happened
+ * after the start of the previous buffer. Every note is then late by exactly
+ * one buffer, instead of by anything between nothing and one buffer. The
+ * events of a song, if one plays, come in between at the sample they have.
+ *
+ * With a recorder the finished buffer is copied into its ring, see
+ * recordAudio. How long that took, and how long the notes took to get here,
+ * goes into engine->latency.
+ */
+void renderAudio(Engine *engine, Uint8 *stream, int len) {
+    int bytes = engine->frame_bytes;
+    int frames = len / bytes;
+    Uint64 start = engine->last_start;
+    Uint64 freq = SDL_GetPerformanceFrequency();
+    EventQueue *queues[2] = { &engine->queue, &engine->midi };
+    Applied applied[2]; // when the notes in this buffer happened, by queue
+    applied[0].count = 0;
+    applied[1].count = 0;
+    NoteEvent ev;
+
+    engine->last_start = SDL_GetPerformanceCounter();
+    takeWave(engine);
+    takeBypass(&engine->effects);
+    engine->tuned = SDL_AtomicGetPtr((void**)&engine->tuning);
+    engine->osc_ticks = 0;
+    engine->mix_ticks = 0;
+    engine->effects_ticks = 0;
+    engine->normalize_ticks = 0;
+    engine->record_ticks = 0;
+    engine->peak = 0;
+    engine->energy = 0;
+    int sounding = engine->voices.active;
+
+    // first ensure silence in the stream
+    SDL_memset(stream, engine->spec.silence, len);
+
+    Song *song = engine->song;
+    if (song) {
+        takeSeek(engine);
+    }
+
+    int done = 0;
+    for (;;) {
+        // whichever comes first, the next event of either queue or the song's
+        Sint64 at = frames;
+        int from = 0;
+        SongEvent *note = NULL;
+        for (int q = 0; q < 2; q++) {
+            NoteEvent next;
+            if (!peekEvent(queues[q], &next)) {
+                continue;
+            }
+            Sint64 t = ((Sint64)(next.time - start) * engine->spec.freq +
+                    (Sint64)freq / 2) / (Sint64)freq;
+            if (t < at) {
+                at = t;
+                ev = next;
+                from = q;
+            }
+        }
+        if (song && song->next < song->count &&
+                (Sint64)(song->events[song->next].frame - song->frame) < at) {
+            note = &song->events[song->next];
+            at = note->frame - song->frame;
+        }
+        if (at >= frames) {
+            break; // belongs in the next buffer
+        }
+        if (at > done) {
+            renderFrames(engine, stream + done * bytes, at - done);
+            done = at;
+        }
+        if (note) {
+            NoteEvent play = { 0, note->key, note->on, note->velocity };
+            applyEvent(engine, &play);
+            song->next++;
+            continue;
+        }
+        applyEvent(engine, &ev);
+        popEvent(queues[from]);
+        Applied *a = &applied[from];
+        if (ev.on && ev.key && a->count < (int)SDL_arraysize(a->time)) {
+            a->time[a->count++] = ev.time;
+        }
+    }
+    renderFrames(engine, stream + done * bytes, frames - done);
+    if (song) {
+        song->frame += frames;
+        SDL_AtomicSet(&song->at_ms, (int)(song->frame * 1000 / song->rate));
+    }
+
+    if (engine->recorder) {
+        Uint64 copy = SDL_GetPerformanceCounter();
+        recordAudio(engine->recorder, stream, frames * bytes);
+        engine->record_ticks = SDL_GetPerformanceCounter() - copy;
+    }
+    measureBuffer(engine, frames, sounding, applied);
+    publishHeld(engine);
+    tablesDone(&engine->tables);
+}
+
+/* Whether a voice held note at the end of the last buffer, whatever played
+ * it. Any thread.
+ */
+bool noteHeld(Engine *engine, int note) {
+    return SDL_AtomicGet(&engine->held[note / 32]) >> (note % 32) & 1;
+}
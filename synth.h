@@ -0,0 +1,162 @@
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+#include "effects.h"
+#include "osc.h"
+#include "recorder.h"
+#include "song.h"
+#include "stats.h"
+#include "tables.h"
+#include "voice.h"
+#include "workers.h"
+
+typedef struct Key {
+    char tone[4];   // name of tone, eg A4
+    double freq;    // frequency of tone, eg 440hz, see Tuning
+    char key;       // keyboard scan code
+    SDL_Rect *rect; // rectangle on screen
+    int note;       // MIDI note number, A4 is 69
+} Key;
+
+#define KEY_CHARS 128 // keyboard keys that can play a note are ASCII
+
+#define KEY_BINDINGS 61 // built-in ones, see key_bindings
+
+/* A keycode that plays a key, shift plays the black keys
+ */
+typedef struct Binding {
+    char tone[4];   // name of the key's tone, eg C4 or C4#
+    char key;       // keycode that plays it
+} Binding;
+
+typedef struct Keys {
+    Key *white;     // pointer to array of 'white' keys
+    int w_len;      // how many white keys there are
+    Key *black;     // pointer to array of 'black' keys
+    int b_len;      // how many black keys there are
+    Key *by_char[2][KEY_CHARS]; // key for every keycode, [1] with shift
+    Key *by_note[NOTES]; // key for every MIDI note number
+} Keys;
+
+/* A key going down or up. time is the SDL_GetPerformanceCounter() value of
+ * when it happened, the audio thread turns that into a sample position.
+ * Without a key it is the sustain pedal going down or up.
+ */
+typedef struct NoteEvent {
+    Uint64 time;
+    Key *key;
+    bool on;
+    Uint8 velocity; // 1 to 127, how hard the key went down
+} NoteEvent;
+
+#define FULL_VELOCITY 127 // what the computer keyboard and mouse play at
+
+#define EVENT_QUEUE_SIZE 256 // must be a power of 2
+
+#define MIN_FRAMES 16       // smallest buffer -b takes, see REVERB_MIN_BLOCK
+#define MAX_FRAMES 32768    // and the largest
+
+/* Lock-free ring buffer that carries note events from the thread handling
+ * input (the only one that pushes) to the audio thread (the only one that
+ * pops). One slot is always left empty to tell full from empty.
+ */
+typedef struct EventQueue {
+    NoteEvent events[EVENT_QUEUE_SIZE];
+    SDL_atomic_t head;  // next slot to write, only moved by the producer
+    SDL_atomic_t tail;  // next slot to read, only moved by the consumer
+} EventQueue;
+
+/* The frequency of every note, as the audio thread plays them. One that the
+ * audio thread may be reading is never changed: retune makes a new one and
+ * swaps it in.
+ */
+typedef struct Tuning {
+    double freq[NOTES]; // of every note there is a key for, else 0
+} Tuning;
+
+/* What one render thread mixes its voices into, so that no two threads
+ * write the same memory. The first lane is the engine's own mix and voice.
+ */
+typedef struct Lane {
+    float *mix;
+    float *voice;
+    Uint64 osc_ticks; // spent in oscillators during this buffer so far
+    Uint64 mix_ticks; // and in envelopes and mixing
+} Lane;
+
+/* Everything the render code works with. The buffers are allocated once by
+ * setupEngine when the device is opened, rendering never allocates.
+ */
+typedef struct Engine {
+    Keys *keys;     // the keyboard that is being played
+    SDL_AudioSpec spec; // format we render in
+    float *mix;     // accumulator into which all pressed keys are mixed
+    float *voice;   // scratch buffer a single key is rendered into
+    float *out;     // the mix copied to every channel, when there are several
+    int mix_len;    // how many frames fit into mix (and voice and out)
+    int frame_bytes; // size of one frame in the output, all channels
+    Voices voices;  // the keys that are sounding
+    WorkerPool *pool; // threads that help render voices, NULL for none
+    Lane lanes[MAX_THREADS]; // one for each thread that renders
+    WaveForm wave;  // the wave form of this buffer, see renderAudio
+    OscKernel kernel; // and the kernel that renders it
+    Tuning *tuning; // the frequencies of the notes, swapped whole by retune
+    const Tuning *tuned; // and the ones this buffer plays at
+    WaveTables tables; // precomputed waves, if wave_tables is set
+    EventQueue queue; // note events on their way to the audio thread
+    EventQueue midi; // and those of the MIDI input, see midi.c
+    bool sustain;   // the pedal is down, render thread only
+    Uint64 last_start; // performance counter at the start of the last buffer
+    Latency latency; // how long buffers and notes took, see renderAudio
+    StatsLog *log;  // where the time in every buffer went
+    Recorder *recorder; // gets a copy of every buffer, NULL when not recording
+    Song *song;     // played along with the queued events, NULL for none
+    EffectBus effects; // what the mix goes through before the limiter
+    Uint64 osc_ticks; // spent in oscillators during this buffer so far, by
+    Uint64 mix_ticks; // all threads, and in envelopes and mixing
+    Uint64 effects_ticks; // and in the effects
+    Uint64 normalize_ticks; // and in gain and conversion
+    Uint64 record_ticks; // and copying the buffer for the recorder
+    float peak;     // loudest sample in this buffer so far
+    float energy;   // and the sum of the squares of its samples
+    float limiter;  // gain the limiter applied last, 1 when it is idle
+    SDL_atomic_t held[NOTES / 32]; // a bit for every note a voice holds,
+                                   // for the display, see noteHeld
+} Engine;
+
+extern WaveForm wave;
+extern Sint8 volume;
+extern double A4;
+extern Envelope envelopes[WAVE_FORMS];
+extern int polyphony;
+extern StealMode steal_mode;
+extern bool low_latency;
+extern int render_threads;
+extern bool deterministic;
+extern const Binding key_bindings[KEY_BINDINGS];
+
+bool keyToTone(Key* keys, int len, const char *s, char c);
+void setupKeys(Keys* keys,
+        char s_key, int s_octave, char e_key, int e_octave);
+void tuneKeys(Keys *keys, double a4);
+void bindKeys(Keys *keys, const Binding *bindings, int len);
+Key *findKey(Keys *keys, const char *tone);
+Key *keyForChar(Keys *keys, int c, bool shift);
+Key *keyForNote(Keys *keys, int note);
+int addFrequencies(Engine *engine, int alen);
+bool canRender(const SDL_AudioSpec *spec);
+bool setupEngine(Engine *engine, Keys *keys, SDL_AudioSpec *spec);
+void freeEngine(Engine *engine);
+bool retune(Engine *engine, double a4);
+bool pushEvent(EventQueue *queue, const NoteEvent *ev);
+bool peekEvent(EventQueue *queue, NoteEvent *ev);
+void popEvent(EventQueue *queue);
+bool sendNote(Engine *engine, Key *key, bool on);
+void takeWave(Engine *engine);
+void applyEvent(Engine *engine, const NoteEvent *ev);
+void renderAudio(Engine *engine, Uint8 *stream, int len);
+bool noteHeld(Engine *engine, int note);
+
+#endif
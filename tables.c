@@ -0,0 +1,209 @@
+#include <math.h>
+#include "tables.h"
+
+#define ANALYSIS_LEN 8192 // points a period of the naive wave is sampled at
+#define HARMONICS (TABLE_LEN / 4) // at most, so that interpolating holds up
+
+bool wave_tables = false;
+
+// the naive shapes the tables are made from; noise has none, and neither
+// do the FM wave forms, whose sound changes as their operators' envelopes go
+static float (*const shapes[WAVE_FORMS])(float) = {
+    squareAt, triangleAt, sawAt, NULL, sinTurn, NULL, NULL, NULL
+};
+
+/* Empty cache for the given sample rate, addTableNote says what notes it is
+ * for
+ */
+void setupWaveTables(WaveTables *tables, int rate) {
+    SDL_memset(tables, 0, sizeof(*tables));
+    tables->rate = rate;
+    for (int n = 0; n < NOTES; n++) {
+        tables->slot[n] = -1;
+    }
+}
+
+/* Gives note a table in every set built from now on, only to be called
+ * before the first buildWaveTables
+ */
+void addTableNote(WaveTables *tables, int note, double freq) {
+    if (tables->slot[note] < 0) {
+        tables->slot[note] = tables->slots++;
+    }
+    tables->freq[note] = freq;
+}
+
+/* Fourier series of one period of the naive wave: cosine terms in a, sine
+ * terms in b, a[0] the average
+ */
+static void analyze(WaveForm wave, const double *cosines, double *a,
+        double *b) {
+    static float x[ANALYSIS_LEN];
+    for (int k = 0; k < ANALYSIS_LEN; k++) {
+        x[k] = shapes[wave]((float)k / ANALYSIS_LEN);
+    }
+    for (int h = 0; h <= HARMONICS; h++) {
+        double re = 0;
+        double im = 0;
+        for (int k = 0; k < ANALYSIS_LEN; k++) {
+            int at = (int)(((Sint64)h * k) % ANALYSIS_LEN);
+            re += x[k] * cosines[at];
+            im += x[k] * cosines[(at + ANALYSIS_LEN * 3 / 4) % ANALYSIS_LEN];
+        }
+        a[h] = re * 2 / ANALYSIS_LEN;
+        b[h] = im * 2 / ANALYSIS_LEN;
+    }
+    a[0] /= 2;
+}
+
+/* Sums the harmonics of a wave that a note at freq can have without going
+ * over the Nyquist frequency into a table
+ */
+static void synthesize(const double *a, const double *b,
+        const double *cosines, double freq, int rate, float *table) {
+    int step = ANALYSIS_LEN / TABLE_LEN;
+    int top = (int)(rate / 2 / freq);
+    if (top > HARMONICS) {
+        top = HARMONICS;
+    }
+    for (int j = 0; j < TABLE_LEN; j++) {
+        double y = a[0];
+        for (int h = 1; h <= top; h++) {
+            int at = (int)(((Sint64)h * j * step) % ANALYSIS_LEN);
+            y += a[h] * cosines[at] +
+                b[h] * cosines[(at + ANALYSIS_LEN * 3 / 4) % ANALYSIS_LEN];
+        }
+        table[j] = (float)y;
+    }
+    table[TABLE_LEN] = table[0];
+}
+
+/* Builds the tables of wave for all notes, unless it already has them.
+ * Main thread only, this takes a few tens of milliseconds. Returns false
+ * if the wave cannot have tables: noise, over the budget or out of memory.
+ */
+bool buildWaveTables(WaveTables *tables, WaveForm wave) {
+    static double cosines[ANALYSIS_LEN];
+    static double a[HARMONICS + 1];
+    static double b[HARMONICS + 1];
+    size_t bytes = sizeof(float) * (TABLE_LEN + 1) * tables->slots;
+
+    if (SDL_AtomicGetPtr(&tables->set[wave]) != NULL) {
+        return true;
+    }
+    if (shapes[wave] == NULL || tables->slots == 0 ||
+            tables->used + bytes > TABLE_BUDGET) {
+        return false;
+    }
+    float *set = SDL_malloc(bytes);
+    if (set == NULL) {
+        return false;
+    }
+
+    for (int k = 0; k < ANALYSIS_LEN; k++) {
+        cosines[k] = cos(2 * M_PI * k / ANALYSIS_LEN);
+    }
+    analyze(wave, cosines, a, b);
+    for (int n = 0; n < NOTES; n++) {
+        if (tables->slot[n] >= 0) {
+            synthesize(a, b, cosines, tables->freq[n], tables->rate,
+                    set + tables->slot[n] * (TABLE_LEN + 1));
+        }
+    }
+
+    tables->used += bytes;
+    SDL_AtomicSetPtr(&tables->set[wave], set); // with a full memory barrier
+    return true;
+}
+
+/* Frees mem, which the audio thread may have got hold of before it was
+ * swapped out, once that thread has finished a buffer: freeRetired does
+ * it. Main thread only. If there is no memory to remember it in, mem is
+ * never freed rather than freed too soon.
+ */
+void freeLater(WaveTables *tables, void *mem) {
+    if (mem == NULL) {
+        return;
+    }
+    if (tables->retired_len == tables->retired_cap) {
+        int cap = tables->retired_cap > 0 ? tables->retired_cap * 2 : 16;
+        void **more = SDL_realloc(tables->retired, sizeof(void*) * cap);
+        if (more == NULL) {
+            return;
+        }
+        tables->retired = more;
+        tables->retired_cap = cap;
+    }
+    tables->retired[tables->retired_len++] = mem;
+    // a buffer that got hold of it before the swap ends before the next one
+    // starts, so any buffer finished from here on is enough
+    tables->retired_at = SDL_AtomicGet(&tables->epoch);
+}
+
+/* Frees what freeLater was given, waiting up to ms for the audio thread to
+ * finish a buffer. Returns false if it did not, then everything is kept
+ * for a later call. Main thread only.
+ */
+bool freeRetired(WaveTables *tables, int ms) {
+    if (tables->retired_len == 0) {
+        return true;
+    }
+    while (SDL_AtomicGet(&tables->epoch) == tables->retired_at) {
+        if (ms-- <= 0) {
+            return false;
+        }
+        SDL_Delay(1);
+    }
+    for (int i = 0; i < tables->retired_len; i++) {
+        SDL_free(tables->retired[i]);
+    }
+    tables->retired_len = 0;
+    return true;
+}
+
+/* Throws all tables away, to be built again with the notes' new frequencies.
+ * Main thread only.
+ */
+void dropWaveTables(WaveTables *tables) {
+    for (int w = 0; w < WAVE_FORMS; w++) {
+        freeLater(tables, SDL_AtomicSetPtr(&tables->set[w], NULL));
+    }
+    tables->used = 0;
+    freeRetired(tables, RETIRE_WAIT);
+}
+
+/* Frees everything, once the audio thread is gone
+ */
+void freeWaveTables(WaveTables *tables) {
+    for (int w = 0; w < WAVE_FORMS; w++) {
+        SDL_free(SDL_AtomicSetPtr(&tables->set[w], NULL));
+    }
+    for (int i = 0; i < tables->retired_len; i++) {
+        SDL_free(tables->retired[i]);
+    }
+    SDL_free(tables->retired);
+    tables->retired = NULL;
+    tables->retired_len = 0;
+    tables->retired_cap = 0;
+    tables->used = 0;
+}
+
+/* The table of note for wave, or NULL if there is none (yet). Safe to call
+ * from the audio thread, the table stays valid until that thread calls
+ * tablesDone.
+ */
+const float *waveTable(WaveTables *tables, WaveForm wave, int note) {
+    float *set = SDL_AtomicGetPtr(&tables->set[wave]);
+    int slot = tables->slot[note];
+    if (set == NULL || slot < 0) {
+        return NULL;
+    }
+    return set + slot * (TABLE_LEN + 1);
+}
+
+/* Called by the audio thread after every buffer: it holds on to no tables
+ * from here on
+ */
+void tablesDone(WaveTables *tables) {
+    SDL_AtomicAdd(&tables->epoch, 1);
+}
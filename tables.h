@@ -0,0 +1,58 @@
+#ifndef TABLES_H
+#define TABLES_H
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+#include "dsp.h"
+#include "osc.h"
+#include "voice.h"
+
+#define TABLE_BUDGET (4 << 20) // bytes all tables together may take
+#define RETIRE_WAIT 200 // ms dropWaveTables waits for the audio thread
+
+/* Optional cache of one period of every wave for every key, so that the
+ * audio thread reads samples instead of working them out. A table holds
+ * TABLE_LEN + 1 floats (8 KiB), the 61 keys of the piano take about 500 KiB
+ * per wave form and all four that can have tables (noise and the FM ones
+ * cannot) about 2 MiB, within TABLE_BUDGET. A wave form that would go over
+ * the budget keeps being rendered the normal way.
+ *
+ * Every table is band-limited for the key it belongs to: it only has the
+ * harmonics below the Nyquist frequency, so it is cleaner than PolyBLEP.
+ *
+ * Tables are built lazily, one wave form at a time, on the main thread
+ * (buildWaveTables when a wave form gets picked), never on the audio thread.
+ * Until a wave form has them the analytic kernels are used. A built set is
+ * published with a single pointer swap. Dropped ones (because A4 changed,
+ * say) are only freed once the audio thread has finished the buffer it may
+ * be reading them for. dropWaveTables waits up to RETIRE_WAIT ms for that;
+ * when no buffer ends in that time (the device is paused, say) they are
+ * kept, and freed by a later call that finds one has.
+ */
+typedef struct WaveTables {
+    void *set[WAVE_FORMS]; // tables for every key, NULL until built
+    double freq[NOTES]; // frequency of every note there is a key for, or 0
+    Sint16 slot[NOTES]; // where the table of a note is in its set
+    int slots;          // how many notes have a table
+    int rate;
+    size_t used;        // bytes taken by the sets that are built
+    SDL_atomic_t epoch; // buffers the audio thread has finished
+    void **retired;     // swapped out, but a buffer may still be reading
+    int retired_len;
+    int retired_cap;
+    int retired_at;     // epoch when the last of them was swapped out
+} WaveTables;
+
+extern bool wave_tables;
+
+void setupWaveTables(WaveTables *tables, int rate);
+void addTableNote(WaveTables *tables, int note, double freq);
+bool buildWaveTables(WaveTables *tables, WaveForm wave);
+void dropWaveTables(WaveTables *tables);
+void freeLater(WaveTables *tables, void *mem);
+bool freeRetired(WaveTables *tables, int ms);
+void freeWaveTables(WaveTables *tables);
+const float *waveTable(WaveTables *tables, WaveForm wave, int note);
+void tablesDone(WaveTables *tables);
+
+#endif
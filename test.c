@@ -0,0 +1,595 @@
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <SDL2/SDL.h>
+#include "dsp.h"
+#include "midi.h"
+#include "reverb.h"
+#include "synth.h"
+#include "wav.h"
+
+/* Regression test for the synthesis core: renders a few short scenes
+ * through the engine, the way the audio callback does, with every kernel
+ * set this CPU has, and compares the output with the golden .wav files in
+ * golden/. No audio device or display needed.
+ *
+ * It also records a scene while rendering it and checks that the recording
+ * holds exactly what was rendered, and reads a MIDI file it makes up to
+ * check the times of its notes and that seeking in it finds the notes a
+ * walk from the start would. On Linux it plays MIDI into a FIFO and checks
+ * what the input thread makes of it and what that does to the voices.
+ * Last, the reverb has to come out as a plain convolution would.
+ *
+ * `piano-test -w` writes the golden files instead, after a change that is
+ * meant to change the sound. Listen to them before committing them.
+ */
+
+#define RATE 44100
+#define BUFFER 256      // frames per renderAudio call, as a small device would
+#define FRAMES 8192     // length of every scene
+#define RELEASE 4096    // frame at which the keys go up again
+#define TOLERANCE 1e-6f // differences allowed, for libm's sin and tanh
+#define RECORDING "piano-test.wav" // made and removed again
+#define SONG_FILE "piano-test.mid"  // this too
+#define SONG_NOTES 3000             // made up notes after the first four
+#define MIDI_FIFO "piano-test.fifo" // and this
+#define REVERB_IR 3000  // samples in the made up impulse response
+
+typedef struct Scene {
+    const char *name;
+    WaveForm wave;
+    const char *tones[4]; // keys that go down at frame 0, up at RELEASE,
+                          // "*" for all of them
+    Sint8 volume;
+    bool band_limited;
+    bool wave_tables;
+    int threads;        // deterministic when more than 1
+} Scene;
+
+static const Scene scenes[] = {
+    { "square", square, { "C4", "E4", "G4" }, 10, true, false, 1 },
+    { "triangle", triangle, { "C4", "E4", "G4" }, 10, true, false, 1 },
+    { "saw", saw, { "C4", "E4", "G4" }, 10, true, false, 1 },
+    { "noise", noise, { "C4", "E4", "G4" }, 10, true, false, 1 },
+    { "sine", sine, { "C4", "E4", "G4" }, 10, true, false, 1 },
+    { "opl2_1", opl2_1, { "C4", "E4", "G4" }, 10, true, false, 1 },
+    { "opl2_2", opl2_2, { "C4", "E4", "G4" }, 10, true, false, 1 },
+    { "opl2_3", opl2_3, { "C4", "E4", "G4" }, 10, true, false, 1 },
+    { "naive_saw", saw, { "C6", "E6", "G6" }, 10, false, false, 1 },
+    { "table_saw", saw, { "C6", "E6", "G6" }, 10, true, true, 1 },
+    { "limiter", square, { "*" }, 127, true, false, 1 },
+    { "threads", sine, { "*" }, 10, true, false, 4 }
+};
+
+/* Presses or releases the keys of a scene
+ */
+static void pressKeys(Engine *engine, Keys *keys, const Scene *scene, bool on) {
+    NoteEvent ev;
+    ev.time = 0;
+    ev.on = on;
+    ev.velocity = FULL_VELOCITY;
+    if (SDL_strcmp(scene->tones[0], "*") == 0) {
+        for (int i = 0; i < keys->w_len + keys->b_len; i++) {
+            ev.key = i < keys->w_len ? &keys->white[i] :
+                &keys->black[i - keys->w_len];
+            applyEvent(engine, &ev);
+        }
+        return;
+    }
+    for (int i = 0; i < 4 && scene->tones[i]; i++) {
+        ev.key = findKey(keys, scene->tones[i]);
+        applyEvent(engine, &ev);
+    }
+}
+
+/* Renders a scene into out, FRAMES floats, and into rec unless that is
+ * NULL. Returns false if the engine could not be set up.
+ */
+static bool renderScene(const Scene *scene, Keys *keys, float *out,
+        Recorder *rec) {
+    SDL_AudioSpec spec;
+    SDL_memset(&spec, 0, sizeof(spec));
+    spec.freq = RATE;
+    spec.format = AUDIO_F32SYS;
+    spec.channels = 1;
+    spec.samples = BUFFER;
+
+    wave = scene->wave;
+    volume = scene->volume;
+    band_limited = scene->band_limited;
+    wave_tables = scene->wave_tables;
+    render_threads = scene->threads;
+    deterministic = true;
+    polyphony = NOTES;
+    noise_seed = 1;
+
+    Engine engine;
+    if (!setupEngine(&engine, keys, &spec)) {
+        freeEngine(&engine);
+        return false;
+    }
+    engine.recorder = rec;
+    pressKeys(&engine, keys, scene, true);
+    for (int frame = 0; frame < FRAMES; frame += BUFFER) {
+        if (frame == RELEASE) {
+            pressKeys(&engine, keys, scene, false);
+        }
+        renderAudio(&engine, (Uint8*)(out + frame), BUFFER * sizeof(float));
+    }
+    freeEngine(&engine);
+    return true;
+}
+
+static bool writeGolden(const char *path, const float *audio) {
+    SDL_AudioSpec spec;
+    WavWriter wav;
+    SDL_memset(&spec, 0, sizeof(spec));
+    spec.freq = RATE;
+    spec.format = AUDIO_F32SYS;
+    spec.channels = 1;
+    return openWav(&wav, path, &spec) &&
+        writeWav(&wav, audio, FRAMES * sizeof(float)) && closeWav(&wav);
+}
+
+/* Reads FRAMES samples of a golden file into audio
+ */
+static bool readGolden(const char *path, float *audio) {
+    SDL_AudioSpec spec;
+    Uint8 *data;
+    Uint32 len;
+    if (SDL_LoadWAV(path, &spec, &data, &len) == NULL) {
+        return false;
+    }
+    bool ok = spec.format == AUDIO_F32SYS && spec.channels == 1 &&
+        len == FRAMES * sizeof(float);
+    if (ok) {
+        SDL_memcpy(audio, data, len);
+    }
+    SDL_FreeWAV(data);
+    return ok;
+}
+
+/* Renders the first scene with a recorder. Returns false if the recording
+ * differs from what was rendered in any way.
+ */
+static bool testRecorder(Keys *keys, float *out, float *recorded) {
+    SDL_AudioSpec spec;
+    SDL_memset(&spec, 0, sizeof(spec));
+    spec.freq = RATE;
+    spec.format = AUDIO_F32SYS;
+    spec.channels = 1;
+    Recorder *rec = startRecorder(RECORDING, &spec);
+    if (rec == NULL) {
+        return false;
+    }
+    bool ok = renderScene(&scenes[0], keys, out, rec);
+    ok = stopRecorder(rec) && ok && SDL_AtomicGet(&rec->overflows) == 0;
+    freeRecorder(rec);
+    ok = ok && readGolden(RECORDING, recorded) &&
+        SDL_memcmp(out, recorded, sizeof(float) * FRAMES) == 0;
+    remove(RECORDING);
+    return ok;
+}
+
+/* Counts the key latencies of a big buffer, 50 to 150 ms. Returns false if
+ * the median is not about 100 ms, as it would be if they fell off the end
+ * of the histogram.
+ */
+static bool testHistogram() {
+    static Histogram hist;
+    resetHistogram(&hist);
+    for (int i = 0; i <= 100; i++) {
+        addDuration(&hist, 0.05 + i * 0.001);
+    }
+    double median = percentile(&hist, 50);
+    return median > 0.0995 && median < 0.1015 && percentile(&hist, 99) < 0.15;
+}
+
+/* Writes a .wav file that is made out to be a few bytes short of full.
+ * Returns false if the last bytes that fit are not taken, one more is, or
+ * the sizes in the header are not those of a full file.
+ */
+static bool testWavLimit() {
+    SDL_AudioSpec spec;
+    WavWriter wav;
+    SDL_memset(&spec, 0, sizeof(spec));
+    spec.freq = RATE;
+    spec.format = AUDIO_S16LSB;
+    spec.channels = 1;
+    if (!openWav(&wav, RECORDING, &spec)) {
+        return false;
+    }
+    Uint8 data[4] = { 0 };
+    wav.bytes = WAV_MAX_BYTES - sizeof(data); // the rest was written before
+    bool ok = writeWav(&wav, data, sizeof(data)) &&
+        !writeWav(&wav, data, 2) && wav.bytes == WAV_MAX_BYTES;
+    ok = closeWav(&wav) && ok;
+
+    SDL_RWops *rw = SDL_RWFromFile(RECORDING, "rb");
+    ok = ok && rw != NULL && SDL_RWseek(rw, 4, RW_SEEK_SET) == 4 &&
+        SDL_ReadLE32(rw) == 36 + WAV_MAX_BYTES &&
+        SDL_RWseek(rw, 40, RW_SEEK_SET) == 40 &&
+        SDL_ReadLE32(rw) == WAV_MAX_BYTES;
+    if (rw != NULL) {
+        SDL_RWclose(rw);
+    }
+    remove(RECORDING);
+    return ok;
+}
+
+/* Writes a type 1 MIDI file: a tempo track going from 120 to 60 bpm after
+ * a quarter note, and a track of notes in running status, the first four of
+ * which have known times. Note ons with velocity 0 end notes, and there is
+ * a drum that has to be left out. Then C3 starts on two channels and ends
+ * on one of them, which must leave the key down.
+ */
+static bool writeSong(const char *path) {
+    static const Uint8 head[] = {
+        'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 1, 0, 2, 0, 96,
+        'M', 'T', 'r', 'k', 0, 0, 0, 18,
+        0, 0xff, 0x51, 3, 0x07, 0xa1, 0x20,     // 500000 us a quarter
+        96, 0xff, 0x51, 3, 0x0f, 0x42, 0x40,    // 1000000 us
+        0, 0xff, 0x2f, 0,
+        'M', 'T', 'r', 'k', 0, 0, 0, 0,         // length comes later
+        0, 0x90, 60, 64,        // C3 on
+        96, 60, 0,              // C3 off, 0.5 s
+        0, 64, 64,              // E3 on
+        96, 0x80, 64, 0,        // E3 off, 1.5 s
+        0, 0x99, 36, 64,        // a drum
+        0, 0x91, 60, 64,        // C3 on, on the second channel
+        0, 0x90, 60, 64,        // and on the first
+        0, 0x91, 60, 0,         // off on the second, held on the first
+        0, 0x90, 36, 64,        // the made up ones
+    };
+    static Uint8 smf[sizeof(head) + SONG_NOTES * 3 + 4];
+    SDL_memcpy(smf, head, sizeof(head));
+    Uint8 *p = smf + sizeof(head);
+    for (int i = 1; i < SONG_NOTES; i++) {
+        *p++ = i % 5;
+        *p++ = 36 + i * 7 % 61;
+        *p++ = i % 3 ? 64 : 0;
+    }
+    SDL_memcpy(p, "\0\xff\x2f\0", 4);
+    p += 4;
+    // the note track's length, big endian before its first event at 48
+    Uint32 len = p - (smf + 48);
+    for (int i = 0; i < 4; i++) {
+        smf[44 + i] = len >> (24 - 8 * i);
+    }
+
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        return false;
+    }
+    bool ok = fwrite(smf, 1, p - smf, f) == (size_t)(p - smf);
+    return fclose(f) == 0 && ok;
+}
+
+/* How many events the song of writeSong should have: all of its notes but
+ * the ends of those whose key, folded into the keyboard by octaves, another
+ * note still holds down
+ */
+static int songEvents(Keys *keys) {
+    bool down[NOTES];
+    int sharing[NOTES];
+    SDL_memset(down, 0, sizeof(down));
+    SDL_memset(sharing, 0, sizeof(sharing));
+    int count = 6; // C3 and E3, then C3 twice, held on the first channel
+    down[60] = true;
+    sharing[60] = 1;
+    for (int i = 0; i < SONG_NOTES; i++) {
+        int note = 36 + i * 7 % 61;
+        bool on = i % 3 != 0 || i == 0;
+        Key *key = NULL;
+        for (int n = note; key == NULL && n < NOTES; n += 12) {
+            key = keyForNote(keys, n);
+        }
+        for (int n = note; key == NULL && n >= 0; n -= 12) {
+            key = keyForNote(keys, n);
+        }
+        if (on != down[note]) {
+            sharing[key->note] += on ? 1 : -1;
+            down[note] = on;
+        }
+        count += on || sharing[key->note] == 0;
+    }
+    return count;
+}
+
+/* Reads the file of writeSong and seeks to every event and just after it.
+ * Returns false if a time or key is wrong, or a seek finds other notes
+ * than going through all events before that point.
+ */
+static bool testSong(Keys *keys) {
+    Song song;
+    bool ok = writeSong(SONG_FILE) && loadSong(SONG_FILE, keys, RATE, &song);
+    remove(SONG_FILE);
+    if (!ok) {
+        return false;
+    }
+    static const struct {
+        Uint64 frame;
+        int note;
+        bool on;
+    } first[] = {
+        { 0, 60, true }, { 22050, 60, false },
+        { 22050, 64, true }, { 66150, 64, false },
+        { 66150, 60, true }, { 66150, 60, true },
+    };
+    ok = song.count == songEvents(keys);
+    for (int i = 0; ok && i < (int)SDL_arraysize(first); i++) {
+        ok = song.events[i].frame == first[i].frame &&
+            song.events[i].key == keyForNote(keys, first[i].note) &&
+            song.events[i].on == first[i].on;
+    }
+
+    for (int i = 0; ok && i < song.count * 2; i++) {
+        Uint64 frame = song.events[i / 2].frame + i % 2;
+        Uint8 held[NOTES];
+        Uint8 walked[NOTES];
+        SDL_memset(walked, 0, sizeof(walked));
+        int next = 0;
+        for (; next < song.count && song.events[next].frame < frame; next++) {
+            const SongEvent *ev = &song.events[next];
+            walked[ev->key->note] = ev->on ? ev->velocity : 0;
+        }
+        seekSong(&song, frame, held);
+        ok = song.next == next && SDL_memcmp(held, walked, sizeof(held)) == 0;
+    }
+    freeSong(&song);
+    return ok;
+}
+
+/* Runs made up noise through a reverb with a made up impulse response, in
+ * pieces of all sorts of lengths, and convolves the two the plain way.
+ * Returns false if the reverb is not that, exactly one block late, give or
+ * take the rounding of the FFTs.
+ */
+static bool testReverb() {
+    static float ir[REVERB_IR];
+    static float in[FRAMES];
+    static float out[FRAMES];
+    Uint32 x = 1;
+    for (int i = 0; i < REVERB_IR; i++) {
+        x = xorshift(x);
+        ir[i] = noiseAt(x) * 0.01f * expf(-i * 0.002f);
+    }
+    for (int i = 0; i < FRAMES; i++) {
+        x = xorshift(x);
+        in[i] = noiseAt(x) * 0.05f;
+        out[i] = in[i];
+    }
+    Reverb *r = newReverb(ir, REVERB_IR, BUFFER);
+    if (r == NULL) {
+        return false;
+    }
+    for (int at = 0, n = 1; at < FRAMES; at += n, n = (n * 37 + 11) % 300) {
+        n = n < FRAMES - at ? n : FRAMES - at;
+        r->effect.process(&r->effect, out + at, n);
+    }
+
+    float worst = 0;
+    float loudest = 0;
+    for (int i = 0; i < FRAMES; i++) {
+        double wet = 0;
+        for (int k = 0; k < REVERB_IR && k <= i - r->block; k++) {
+            wet += ir[k] * in[i - r->block - k];
+        }
+        float d = fabsf(out[i] - in[i] - (float)wet);
+        worst = d > worst ? d : worst;
+        loudest = fabsf((float)wet) > loudest ? fabsf((float)wet) : loudest;
+    }
+    r->effect.destroy(&r->effect);
+    return loudest > 0 && worst < loudest * 1e-5f;
+}
+
+#ifdef __linux__
+/* Writes MIDI with running status, real time bytes in the middle of a note
+ * and a system exclusive message into a FIFO, and applies what comes out
+ * of the input thread. Returns false if those are not the notes and pedal
+ * that were sent, at their velocity, or if the pedal does not hold notes.
+ */
+static bool testMidi(Keys *keys) {
+    static const Uint8 bytes[] = {
+        0x90, 60, 100,          // C3 down
+        64, 0xf8, 127,          // E3, with a clock tick inside
+        0xb0, 64, 127,          // pedal down
+        0x80, 60, 0,            // C3 up, the pedal keeps it
+        0x90, 64, 0,            // E3 up too
+        0xf0, 1, 2, 0xf7,       // system exclusive,
+        60, 100,                // which ends running status
+        0x91, 5, 99,            // no key for that
+        0xb0, 64, 0,            // pedal up, both let go
+    };
+    static const struct {
+        int note;       // -1 for the pedal
+        bool on;
+        int velocity;
+    } expect[] = {
+        { 60, true, 100 }, { 64, true, 127 }, { -1, true, 127 },
+        { 60, false, 0 }, { 64, false, 0 }, { -1, false, 0 },
+    };
+    SDL_AudioSpec spec;
+    SDL_memset(&spec, 0, sizeof(spec));
+    spec.freq = RATE;
+    spec.format = AUDIO_F32SYS;
+    spec.channels = 1;
+    spec.samples = BUFFER;
+    Engine engine;
+    if (!setupEngine(&engine, keys, &spec)) {
+        freeEngine(&engine);
+        return false;
+    }
+
+    remove(MIDI_FIFO);
+    MidiInput *midi = NULL;
+    int fd = -1;
+    bool ok = mkfifo(MIDI_FIFO, 0600) == 0 &&
+        (midi = openMidi(MIDI_FIFO, &engine)) != NULL &&
+        (fd = open(MIDI_FIFO, O_WRONLY)) >= 0 &&
+        write(fd, bytes, sizeof(bytes)) == (ssize_t)sizeof(bytes);
+
+    for (int i = 0; ok && i < (int)SDL_arraysize(expect); i++) {
+        NoteEvent ev;
+        for (int wait = 0; wait < 1000 && !peekEvent(&engine.midi, &ev);
+                wait++) {
+            SDL_Delay(1);
+        }
+        ok = peekEvent(&engine.midi, &ev) &&
+            (expect[i].note < 0 ? ev.key == NULL :
+                ev.key == keyForNote(keys, expect[i].note)) &&
+            ev.on == expect[i].on &&
+            (!ev.on || ev.velocity == expect[i].velocity);
+        if (!ok) {
+            break;
+        }
+        popEvent(&engine.midi);
+        applyEvent(&engine, &ev);
+
+        Voice *c4 = findVoice(&engine.voices, 60);
+        if (i == 0) {
+            ok = c4 && fabsf(c4->gain - 100.0f * 100 / (127 * 127)) < 1e-6f;
+        } else if (i == 3) {
+            ok = c4 && c4->sustained && c4->env.stage != env_release;
+        } else if (i == 5) {
+            ok = c4 && !c4->sustained && c4->env.stage == env_release;
+        }
+    }
+    NoteEvent extra;
+    ok = ok && !peekEvent(&engine.midi, &extra);
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    closeMidi(midi);
+    remove(MIDI_FIFO);
+    freeEngine(&engine);
+    return ok;
+}
+#endif
+
+int main(int argc, char *argv[]) {
+    static float golden[FRAMES];
+    static float out[FRAMES];
+    const char *isas[] = { "scalar", "sse2", "avx2" };
+    bool write = argc == 2 && SDL_strcmp(argv[1], "-w") == 0;
+    int failed = 0;
+
+    if (argc > 1 && !write) {
+        printf("usage: piano-test [-w]\n");
+        return 1;
+    }
+
+    Key white[36];
+    Key black[25];
+    Keys keys;
+    keys.white = white;
+    keys.w_len = 36;
+    keys.black = black;
+    keys.b_len = 25;
+    setupKeys(&keys, 'C', 2, 'C', 7);
+
+    for (int s = 0; s < (int)SDL_arraysize(scenes); s++) {
+        const Scene *scene = &scenes[s];
+        char path[64];
+        SDL_snprintf(path, sizeof(path), "golden/%s.wav", scene->name);
+
+        if (write) {
+            setupKernels();
+            if (!renderScene(scene, &keys, out, NULL) ||
+                    !writeGolden(path, out)) {
+                printf("%-10s could not write %s\n", scene->name, path);
+                return 1;
+            }
+            printf("%-10s wrote %s\n", scene->name, path);
+            continue;
+        }
+
+        if (!readGolden(path, golden)) {
+            printf("%-10s FAIL: cannot read %s\n", scene->name, path);
+            failed++;
+            continue;
+        }
+        for (int isa = 0; isa < (int)SDL_arraysize(isas); isa++) {
+            if (!selectKernels(isas[isa])) {
+                continue;
+            }
+            if (!renderScene(scene, &keys, out, NULL)) {
+                printf("%-10s %-6s FAIL: out of memory\n", scene->name,
+                        isas[isa]);
+                failed++;
+                continue;
+            }
+            float worst = 0;
+            int at = 0;
+            for (int i = 0; i < FRAMES; i++) {
+                float d = fabsf(out[i] - golden[i]);
+                if (d > worst) {
+                    worst = d;
+                    at = i;
+                }
+            }
+            if (worst > TOLERANCE) {
+                printf("%-10s %-6s FAIL: off by %g at frame %d\n",
+                        scene->name, isas[isa], worst, at);
+                failed++;
+            } else {
+                printf("%-10s %-6s ok\n", scene->name, isas[isa]);
+            }
+        }
+    }
+    setupKernels();
+
+    if (!write) {
+        if (testRecorder(&keys, out, golden)) {
+            printf("%-10s ok\n", "recorder");
+        } else {
+            printf("%-10s FAIL: the recording differs\n", "recorder");
+            failed++;
+        }
+        if (testHistogram()) {
+            printf("%-10s ok\n", "histogram");
+        } else {
+            printf("%-10s FAIL: percentiles off\n", "histogram");
+            failed++;
+        }
+        if (testWavLimit()) {
+            printf("%-10s ok\n", "wav limit");
+        } else {
+            printf("%-10s FAIL: wrote past 4 GiB or not up to it\n",
+                    "wav limit");
+            failed++;
+        }
+        if (testSong(&keys)) {
+            printf("%-10s ok\n", "song");
+        } else {
+            printf("%-10s FAIL: wrong notes or seek\n", "song");
+            failed++;
+        }
+#ifdef __linux__
+        if (testMidi(&keys)) {
+            printf("%-10s ok\n", "midi");
+        } else {
+            printf("%-10s FAIL: wrong events or voices\n", "midi");
+            failed++;
+        }
+#endif
+        if (testReverb()) {
+            printf("%-10s ok\n", "reverb");
+        } else {
+            printf("%-10s FAIL: not the convolution\n", "reverb");
+            failed++;
+        }
+    }
+
+    if (failed) {
+        printf("%d failed\n", failed);
+        return 1;
+    }
+    return 0;
+}
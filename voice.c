@@ -0,0 +1,102 @@
+#include "voice.h"
+
+/* Allocates room for capacity voices, all silent
+ */
+bool setupVoices(Voices *voices, int capacity, StealMode steal) {
+    voices->voice = SDL_malloc(sizeof(Voice) * capacity);
+    voices->active = 0;
+    voices->capacity = capacity;
+    voices->limit = capacity;
+    voices->serial = 0;
+    voices->steal = steal;
+    for (int n = 0; n < NOTES; n++) {
+        voices->index[n] = -1;
+    }
+    return voices->voice != NULL;
+}
+
+void freeVoices(Voices *voices) {
+    SDL_free(voices->voice);
+    voices->voice = NULL;
+    voices->active = 0;
+    voices->capacity = 0;
+    voices->limit = 0;
+}
+
+/* The voice playing note, or NULL if it is not sounding
+ */
+Voice *findVoice(Voices *voices, int note) {
+    int i = voices->index[note];
+    return i < 0 ? NULL : &voices->voice[i];
+}
+
+/* Picks the voice to cut off when every voice is in use
+ */
+static int victim(Voices *voices) {
+    int pick = 0;
+    for (int i = 1; i < voices->active; i++) {
+        Voice *v = &voices->voice[i];
+        Voice *p = &voices->voice[pick];
+        if (voices->steal == steal_quietest && v->env.level != p->env.level) {
+            if (v->env.level < p->env.level) {
+                pick = i;
+            }
+        } else if ((Sint32)(v->started - p->started) < 0) {
+            pick = i; // older, or as quiet and older
+        }
+    }
+    return pick;
+}
+
+/* Gives note a voice, taking one from another note if as many as the limit
+ * allows are in use. If the note is still sounding (maybe in its release) it
+ * keeps its voice. A new voice starts silent at the beginning of a period,
+ * the caller starts its envelope.
+ */
+Voice *startVoice(Voices *voices, struct Key *key, int note) {
+    Voice *v = findVoice(voices, note);
+    if (v) {
+        return v;
+    }
+    if (voices->limit == 0) {
+        return NULL;
+    }
+
+    int i;
+    if (voices->active < voices->limit) {
+        i = voices->active++;
+    } else {
+        i = victim(voices);
+        voices->index[voices->voice[i].note] = -1;
+    }
+    v = &voices->voice[i];
+    voices->index[note] = i;
+    v->key = key;
+    v->osc.phase = 0;
+    v->osc.inc = 0;
+    v->note = note;
+    v->env.stage = env_done;
+    v->env.level = 0;
+    v->gain = 1;
+    v->sustained = false;
+    v->started = voices->serial++;
+    seedNoise(&v->osc, v->started);
+    resetFm(&v->fm);
+    return v;
+}
+
+/* Silences note, the last voice moves into its place to keep the sounding
+ * voices together
+ */
+void stopVoice(Voices *voices, int note) {
+    int i = voices->index[note];
+    if (i < 0) {
+        return;
+    }
+    voices->index[note] = -1;
+    int last = --voices->active;
+    if (i != last) {
+        voices->voice[i] = voices->voice[last];
+        voices->index[voices->voice[i].note] = i;
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef VOICE_H
+#define VOICE_H
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+#include "env.h"
+#include "fm.h"
+#include "osc.h"
+
+struct Key;
+
+/* A key that is sounding. Voices hold everything that changes while a note
+ * plays, so the key table itself stays as setupKeys made it.
+ */
+typedef struct Voice {
+    struct Key *key; // the key it is playing
+    int note;       // and its note number
+    Osc osc;        // position in the wave
+    FmVoice fm;     // the operators, for the FM wave forms
+    EnvState env;   // how loud it is, also used to find the quietest
+    float gain;     // its own level, on top of the envelope, 1 for full
+    bool sustained; // let go while the sustain pedal was down
+    Uint32 started; // note-on count when it started, to find the oldest
+} Voice;
+
+typedef enum StealMode {
+    steal_oldest,
+    steal_quietest
+} StealMode;
+
+#define NOTES 128   // MIDI note numbers
+
+/* Fixed pool of voices. The sounding ones are always voice[0] up to
+ * voice[active - 1], so rendering only ever looks at those, and for every
+ * note there is the index of its voice, so finding it takes no searching.
+ */
+typedef struct Voices {
+    Voice *voice;   // room for capacity voices
+    int active;     // how many are sounding
+    int capacity;   // the polyphony
+    int limit;      // how many may sound for now, at most capacity
+    Sint16 index[NOTES]; // where the voice of every note is, -1 for none
+    Uint32 serial;  // counts note-ons
+    StealMode steal; // who makes room when all voices are in use
+} Voices;
+
+bool setupVoices(Voices *voices, int capacity, StealMode steal);
+void freeVoices(Voices *voices);
+Voice *findVoice(Voices *voices, int note);
+Voice *startVoice(Voices *voices, struct Key *key, int note);
+void stopVoice(Voices *voices, int note);
+
+#endif
@@ -0,0 +1,154 @@
+#include "wav.h"
+
+#define WAVE_FORMAT_PCM 1
+#define WAVE_FORMAT_IEEE_FLOAT 3
+#define WAVE_FORMAT_EXTENSIBLE 0xfffe
+
+// the speakers of SDL's channel layouts, for WAVE_FORMAT_EXTENSIBLE
+static const Uint32 channel_masks[9] = {
+    0, 0x4, 0x3, 0x7, 0x33, 0x37, 0x3f, 0x70f, 0x63f
+};
+
+// the rest of the GUID of an extensible format, after its format tag
+static const Uint8 guid_tail[14] = {
+    0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00,
+    0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71
+};
+
+/* Creates path and writes the RIFF header for the given spec. A .wav file
+ * holds unsigned 8 bit, little endian signed 16 and 32 bit and little
+ * endian float audio, up to 8 channels. Signed 8 bit audio is taken too and
+ * written as unsigned; anything else (big endian, say) can only go in a
+ * .raw file.
+ *
+ * The header is the one strict readers want: float audio has the 18 byte
+ * format chunk and a fact chunk with the number of frames, and more than
+ * two channels or more than 16 bits are WAVE_FORMAT_EXTENSIBLE, with the
+ * speakers the channels go to.
+ */
+bool openWav(WavWriter *wav, const char *path, SDL_AudioSpec *spec) {
+    SDL_AudioFormat f = spec->format;
+    Uint16 bits = SDL_AUDIO_BITSIZE(f);
+    Uint16 align = bits / 8 * spec->channels;
+    Uint16 tag = SDL_AUDIO_ISFLOAT(f) ? WAVE_FORMAT_IEEE_FLOAT :
+        WAVE_FORMAT_PCM;
+    bool extensible = spec->channels > 2 || bits > 16;
+    bool fact = tag == WAVE_FORMAT_IEEE_FLOAT;
+    Uint32 fmt_len = extensible ? 40 : fact ? 18 : 16;
+
+    wav->rw = NULL;
+    wav->bytes = 0;
+    wav->raw = false;
+    wav->flip = f == AUDIO_S8;
+    wav->align = align;
+    wav->fact_at = fact ? 20 + fmt_len + 8 : 0;
+    wav->data_at = 20 + fmt_len + (fact ? 12 : 0) + 4;
+    if (f != AUDIO_U8 && f != AUDIO_S8 && f != AUDIO_S16LSB &&
+            f != AUDIO_S32LSB && f != AUDIO_F32LSB) {
+        SDL_SetError("Cannot write audio format 0x%x to a wav file", f);
+        return false;
+    }
+    if (spec->channels < 1 || spec->channels > 8) {
+        SDL_SetError("Cannot write %d channels to a wav file",
+                spec->channels);
+        return false;
+    }
+    wav->rw = SDL_RWFromFile(path, "wb");
+    if (wav->rw == NULL) {
+        return false;
+    }
+
+    SDL_RWwrite(wav->rw, "RIFF", 1, 4);
+    SDL_WriteLE32(wav->rw, 0);          // patched by closeWav
+    SDL_RWwrite(wav->rw, "WAVEfmt ", 1, 8);
+    SDL_WriteLE32(wav->rw, fmt_len);
+    SDL_WriteLE16(wav->rw, extensible ? WAVE_FORMAT_EXTENSIBLE : tag);
+    SDL_WriteLE16(wav->rw, spec->channels);
+    SDL_WriteLE32(wav->rw, spec->freq);
+    SDL_WriteLE32(wav->rw, spec->freq * align);
+    SDL_WriteLE16(wav->rw, align);
+    SDL_WriteLE16(wav->rw, bits);
+    if (extensible) {
+        SDL_WriteLE16(wav->rw, 22);     // bytes that follow
+        SDL_WriteLE16(wav->rw, bits);   // all of them are used
+        SDL_WriteLE32(wav->rw, channel_masks[spec->channels]);
+        SDL_WriteLE16(wav->rw, tag);
+        SDL_RWwrite(wav->rw, guid_tail, 1, sizeof(guid_tail));
+    } else if (fact) {
+        SDL_WriteLE16(wav->rw, 0);      // no more bytes follow
+    }
+    if (fact) {
+        SDL_RWwrite(wav->rw, "fact", 1, 4);
+        SDL_WriteLE32(wav->rw, 4);
+        SDL_WriteLE32(wav->rw, 0);      // frames, patched by closeWav
+    }
+    SDL_RWwrite(wav->rw, "data", 1, 4);
+    if (SDL_WriteLE32(wav->rw, 0) != 1) { // patched by closeWav
+        SDL_RWclose(wav->rw);
+        wav->rw = NULL;
+        return false;
+    }
+    return true;
+}
+
+/* Creates path for samples without a header, in whatever format they come
+ */
+bool openRaw(WavWriter *wav, const char *path) {
+    wav->bytes = 0;
+    wav->raw = true;
+    wav->flip = false;
+    wav->align = 1;
+    wav->rw = SDL_RWFromFile(path, "wb");
+    return wav->rw != NULL;
+}
+
+/* Appends len bytes of audio, in the format given to openWav. Returns false
+ * if they could not be written; if they would make the file too big for its
+ * header none of them are.
+ */
+bool writeWav(WavWriter *wav, const void *data, Uint32 len) {
+    if (!wav->raw && wav->bytes + len > WAV_MAX_BYTES) {
+        SDL_SetError("a .wav file cannot hold more than %u bytes of audio, "
+                "write a .raw file instead", WAV_MAX_BYTES);
+        return false;
+    }
+    if (wav->flip) {
+        // signed 8 bit is unsigned with the top bit the other way round
+        const Uint8 *in = data;
+        Uint8 chunk[WAV_CHUNK];
+        for (Uint32 done = 0; done < len; done += WAV_CHUNK) {
+            Uint32 n = len - done < WAV_CHUNK ? len - done : WAV_CHUNK;
+            for (Uint32 i = 0; i < n; i++) {
+                chunk[i] = in[done + i] ^ 0x80;
+            }
+            if (SDL_RWwrite(wav->rw, chunk, 1, n) != n) {
+                return false;
+            }
+            wav->bytes += n;
+        }
+        return true;
+    }
+    if (SDL_RWwrite(wav->rw, data, 1, len) != len) {
+        return false;
+    }
+    wav->bytes += len;
+    return true;
+}
+
+/* Fills in the sizes in the header, if there is one, and closes the file
+ */
+bool closeWav(WavWriter *wav) {
+    Uint32 frames = (Uint32)(wav->bytes / wav->align);
+    bool ok = wav->raw || (SDL_RWseek(wav->rw, 4, RW_SEEK_SET) == 4 &&
+        SDL_WriteLE32(wav->rw, (Uint32)(wav->data_at - 4 + wav->bytes)) == 1 &&
+        (wav->fact_at == 0 ||
+         (SDL_RWseek(wav->rw, wav->fact_at, RW_SEEK_SET) == wav->fact_at &&
+          SDL_WriteLE32(wav->rw, frames) == 1)) &&
+        SDL_RWseek(wav->rw, wav->data_at, RW_SEEK_SET) == wav->data_at &&
+        SDL_WriteLE32(wav->rw, (Uint32)wav->bytes) == 1);
+    if (SDL_RWclose(wav->rw) != 0) {
+        ok = false;
+    }
+    wav->rw = NULL;
+    return ok;
+}
@@ -0,0 +1,33 @@
+#ifndef WAV_H
+#define WAV_H
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+
+#define WAV_CHUNK 4096  // bytes of signed 8 bit audio flipped at a time
+#define WAV_MAX_BYTES (0xffffffffu - 72) // of audio, so that the size of
+                                         // the file fits whatever the header
+
+/* Streams audio into a .wav file. The header is written with empty sizes
+ * when the file is opened and patched up by closeWav, so the total length
+ * does not need to be known up front. A .wav file holds no more than
+ * WAV_MAX_BYTES of audio, a bit under 4 GiB, and writeWav fails rather than
+ * go past that. Opened with openRaw it writes the bare samples instead,
+ * without a header or a limit.
+ */
+typedef struct WavWriter {
+    SDL_RWops *rw;
+    Uint64 bytes;   // audio data written so far
+    bool raw;       // no header to patch
+    bool flip;      // signed 8 bit audio, written as unsigned
+    int align;      // bytes in a frame
+    Uint32 fact_at; // where the frame count is in the header, 0 for none
+    Uint32 data_at; // and the size of the audio
+} WavWriter;
+
+bool openWav(WavWriter *wav, const char *path, SDL_AudioSpec *spec);
+bool openRaw(WavWriter *wav, const char *path);
+bool writeWav(WavWriter *wav, const void *data, Uint32 len);
+bool closeWav(WavWriter *wav);
+
+#endif
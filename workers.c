@@ -0,0 +1,168 @@
+#ifdef __linux__
+#define _GNU_SOURCE     // for pthread_setaffinity_np
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include "workers.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define spinPause() _mm_pause()
+#else
+#define spinPause()
+#endif
+
+// how often a worker looks for a new job before it parks, some 100 µs
+#define SPINS 20000
+
+/* Keeps the calling thread on one CPU, so that its caches stay warm. Only
+ * done where we know how, elsewhere the scheduler decides.
+ */
+static void pinThread(int cpu) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % SDL_GetCPUCount(), &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)cpu;
+#endif
+}
+
+/* The part of the current job the given thread does: in ordered jobs thread
+ * t always gets the same range of items, otherwise whatever is left
+ */
+static void doWork(WorkerPool *pool, int thread) {
+    if (pool->ordered) {
+        int from = pool->items * thread / pool->threads;
+        int to = pool->items * (thread + 1) / pool->threads;
+        for (int i = from; i < to; i++) {
+            pool->work(pool->data, thread, i);
+        }
+        return;
+    }
+    for (;;) {
+        int i = SDL_AtomicAdd(&pool->next, 1);
+        if (i >= pool->items) {
+            return;
+        }
+        pool->work(pool->data, thread, i);
+    }
+}
+
+static int workerMain(void *arg) {
+    Worker *worker = arg;
+    WorkerPool *pool = worker->pool;
+    int seen = 0;
+
+    pinThread(worker->index);
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+    for (;;) {
+        int job;
+        int spins = 0;
+        while ((job = SDL_AtomicGet(&pool->job)) == seen) {
+            if (++spins < pool->spins) {
+                spinPause();
+                continue;
+            }
+            // park, unless a job came in the meantime and runPool has
+            // not seen us parked: then it did not post and we go on
+            SDL_AtomicSet(&worker->parked, 1);
+            if (SDL_AtomicGet(&pool->job) == seen ||
+                    !SDL_AtomicCAS(&worker->parked, 1, 0)) {
+                SDL_SemWait(worker->wake);
+            }
+            spins = 0;
+        }
+        seen = job;
+        if (SDL_AtomicGet(&pool->quit)) {
+            return 0;
+        }
+        doWork(pool, worker->index);
+        SDL_AtomicAdd(&pool->busy, -1);
+    }
+}
+
+/* Starts threads - 1 workers, pinned to CPU 1 and on. Returns NULL if
+ * threads is out of range or they could not be had.
+ */
+WorkerPool *createPool(int threads) {
+    if (threads < 1 || threads > MAX_THREADS) {
+        return NULL;
+    }
+    WorkerPool *pool = SDL_malloc(sizeof(WorkerPool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    SDL_memset(pool, 0, sizeof(*pool));
+    for (int t = 1; t < threads; t++) {
+        Worker *worker = &pool->worker[t];
+        char name[16];
+        SDL_snprintf(name, sizeof(name), "voices %d", t);
+        worker->pool = pool;
+        worker->index = t;
+        worker->wake = SDL_CreateSemaphore(0);
+        if (worker->wake) {
+            worker->thread = SDL_CreateThread(workerMain, name, worker);
+        }
+        if (worker->thread == NULL) {
+            SDL_DestroySemaphore(worker->wake);
+            freePool(pool);
+            return NULL;
+        }
+        pool->threads = t + 1;
+    }
+    pool->threads = threads;
+    // with fewer CPUs than threads, spinning only keeps others from working
+    pool->spins = SDL_GetCPUCount() >= threads ? SPINS : 1;
+    return pool;
+}
+
+/* Has work done for items 0 up to items - 1 by all threads of the pool,
+ * this one included, and returns when they are all done. Items of an
+ * ordered job are split the same way every time, so what a thread adds up
+ * does not depend on timing.
+ */
+void runPool(WorkerPool *pool, WorkItem work, void *data, int items,
+        bool ordered) {
+    pool->work = work;
+    pool->data = data;
+    pool->items = items;
+    pool->ordered = ordered;
+    SDL_AtomicSet(&pool->next, 0);
+    SDL_AtomicSet(&pool->busy, pool->threads - 1);
+    SDL_AtomicIncRef(&pool->job);
+    for (int t = 1; t < pool->threads; t++) {
+        if (SDL_AtomicCAS(&pool->worker[t].parked, 1, 0)) {
+            SDL_SemPost(pool->worker[t].wake);
+        }
+    }
+
+    doWork(pool, 0);
+    for (int spins = 0; SDL_AtomicGet(&pool->busy) > 0; spins++) {
+        if (spins < pool->spins) {
+            spinPause();
+        } else {
+            SDL_Delay(0);
+        }
+    }
+}
+
+/* Stops the workers and frees the pool, NULL is fine
+ */
+void freePool(WorkerPool *pool) {
+    if (pool == NULL) {
+        return;
+    }
+    SDL_AtomicSet(&pool->quit, 1);
+    SDL_AtomicIncRef(&pool->job);
+    for (int t = 1; t < pool->threads; t++) {
+        Worker *worker = &pool->worker[t];
+        if (SDL_AtomicCAS(&worker->parked, 1, 0)) {
+            SDL_SemPost(worker->wake);
+        }
+        SDL_WaitThread(worker->thread, NULL);
+        SDL_DestroySemaphore(worker->wake);
+    }
+    SDL_free(pool);
+}
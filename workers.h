@@ -0,0 +1,51 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+
+#define MAX_THREADS 16  // threads that render together, the caller included
+
+// does item number item, on the thread with the given number (0 the caller)
+typedef void (*WorkItem)(void *data, int thread, int item);
+
+struct WorkerPool;
+
+/* A helper thread. Between jobs it spins for a while, as the next buffer
+ * usually comes soon, and then parks on its semaphore.
+ */
+typedef struct Worker {
+    struct WorkerPool *pool;
+    int index;          // its thread number, from 1
+    SDL_Thread *thread;
+    SDL_sem *wake;      // posted when a job comes while it is parked
+    SDL_atomic_t parked; // 1 while it waits, or is about to, on wake
+} Worker;
+
+/* Threads that are created once, up front, and then help the thread that
+ * calls runPool with every job it has. Nothing is locked and nothing is
+ * allocated while a job runs: the items are handed out with an atomic
+ * counter, or in fixed ranges if the job is ordered, and the caller spins
+ * until the last worker is done. The system calls it may make are waking a
+ * parked worker and, once it has spun spins times, yielding the CPU.
+ */
+typedef struct WorkerPool {
+    Worker worker[MAX_THREADS];
+    int threads;        // the caller and threads - 1 workers
+    int spins;          // how long to wait for others before letting them run
+    WorkItem work;      // the job that is running
+    void *data;
+    int items;
+    bool ordered;
+    SDL_atomic_t job;   // counts jobs, workers watch it for a new one
+    SDL_atomic_t next;  // the next item to hand out
+    SDL_atomic_t busy;  // workers still on the job
+    SDL_atomic_t quit;
+} WorkerPool;
+
+WorkerPool *createPool(int threads);
+void runPool(WorkerPool *pool, WorkItem work, void *data, int items,
+        bool ordered);
+void freePool(WorkerPool *pool);
+
+#endif